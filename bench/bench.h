@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Support shared by the benchmarks, which run parts of tachyon without a
+ * controller, slaves or the real clock.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+struct buffer;
+
+/* Bytes the buffers have output to the controller */
+extern unsigned long bench_controller_bytes;
+
+void vclock_set(uint64_t now);
+void bench_run_timer(struct buffer *buffer, uint64_t now);
+
+#endif
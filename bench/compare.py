@@ -0,0 +1,203 @@
+# Run the benchmarks, write their results as JSON and compare them against a
+# baseline, exiting with failure if any result regressed by more than the
+# tolerance the baseline allows it.
+#
+# Throughput and latency depend on the machine, so the baseline should be
+# regenerated with -u on the machine the comparisons are run on. They are
+# also noisy on shared machines so are given loose tolerances, while the
+# allocations, bytes drawn and bytes held per line are exact and are held to
+# tight ones.
+
+from __future__ import print_function
+
+import re
+import sys
+import json
+import getopt
+import subprocess
+
+# Tolerance given to new results when the baseline is updated, by the suffix
+# of their name. A result regresses when it is worse than the baseline by more
+# than the relative tolerance plus the absolute slack.
+DEFAULTS = {
+	'mb_per_s': {'better': 'higher', 'tolerance': 0.5, 'slack': 0},
+	'allocs_per_mb': {'better': 'lower', 'tolerance': 0.05, 'slack': 1},
+	'out_per_byte': {'better': 'lower', 'tolerance': 0.01, 'slack': 0},
+	'redraw_per_byte': {'better': 'lower', 'tolerance': 0.01, 'slack': 0},
+	'bytes_per_line': {'better': 'lower', 'tolerance': 0.05, 'slack': 0},
+	'p50_ms': {'better': 'lower', 'tolerance': 1.0, 'slack': 0.5},
+	'idle_p50_us': {'better': 'lower', 'tolerance': 1.0, 'slack': 5},
+	'mispredicted': {'better': 'lower', 'tolerance': 0, 'slack': 0},
+}
+
+# Results which are only reported, by the suffix of their name. Tail latency
+# is dominated by scheduling on a shared machine and is too noisy to compare.
+REPORTED = ['p99_ms']
+
+def reported(name):
+	return name.rsplit('.', 1)[1] in REPORTED
+
+def run(args):
+	print(' '.join(args), file=sys.stderr)
+	output = subprocess.check_output(args)
+	return output.decode('utf-8', 'replace').splitlines()
+
+def vtbench(results):
+	line = re.compile(r'^(\S+)\s+([\d.]+) MB/s\s+[\d.]+ ns/byte\s+([\d.]+) allocs/MB\s+([\d.]+) out/byte\s+([\d.]+) redraw/byte$')
+	for output in run(['bench/vtbench', '-s', '1', '-n', '10']):
+		match = line.match(output)
+		if match:
+			name = 'vtbench.' + match.group(1)
+			results[name + '.mb_per_s'] = float(match.group(2))
+			results[name + '.allocs_per_mb'] = float(match.group(3))
+			results[name + '.out_per_byte'] = float(match.group(4))
+			results[name + '.redraw_per_byte'] = float(match.group(5))
+
+def memfoot(results):
+	line = re.compile(r'^\s*(\d+)\s+\d+\s+\d+\s+\d+\s+([\d.]+)\s+[\d.]+\s+[\d.]+$')
+	for output in run(['bench/memfoot', '-n', '2', '-m', '5000']):
+		match = line.match(output)
+		if match:
+			results['memfoot.%s.bytes_per_line' % match.group(1)] = float(match.group(2))
+
+def keylat(results):
+	line = re.compile(r'^(off|on)\s+([\d.]+) ms\s+([\d.]+) ms\s+')
+	for output in run(['bench/keylat', '-d', '0', '-n', '300', '-i', '5', '-w', '20']):
+		match = line.match(output)
+		if match:
+			name = 'keylat.predict_' + match.group(1)
+			results[name + '.p50_ms'] = float(match.group(2))
+			results[name + '.p99_ms'] = float(match.group(3))
+
+def looptrip(results):
+	line = re.compile(r'^\s*(\d+)\s+([\d.]+)\s+[\d.]+\s+\d+\s+[\d.]+\s+[\d.]+$')
+	for output in run(['bench/looptrip', '-p', '-n', '2000']):
+		match = line.match(output)
+		if match:
+			results['looptrip.%s.idle_p50_us' % match.group(1)] = float(match.group(2))
+
+# typing.rec is four lines typed faster than the echo returned over a 40ms
+# link, so keys are in flight whenever Enter is answered
+def predeval(results):
+	line = re.compile(r'^mispredicted cells\s+(\d+)')
+	for rtt in ['50', '200']:
+		for output in run(['bench/predeval', '-r', rtt, 'bench/typing.rec']):
+			match = line.match(output)
+			if match:
+				results['predeval.typing_%sms.mispredicted' % rtt] = float(match.group(1))
+
+def defaults(name):
+	return dict(DEFAULTS[name.rsplit('.', 1)[1]])
+
+def regressed(result, base):
+	limit = base['value'] * base['tolerance'] + base['slack']
+	if base['better'] == 'higher':
+		return result < base['value'] - limit
+	return result > base['value'] + limit
+
+def compare(results, baseline):
+	failures = 0
+
+	print('%-40s %12s %12s %8s' % ('benchmark', 'baseline', 'result', 'change'))
+	for name in sorted(results):
+		result = results[name]
+		if reported(name):
+			print('%-40s %12s %12.3f %8s not compared' % (name, '', result, ''))
+			continue
+		if name not in baseline:
+			print('%-40s %12s %12.3f %8s new' % (name, '', result, ''))
+			continue
+
+		base = baseline[name]
+		if base['value']:
+			change = '%+7.1f%%' % ((result - base['value']) * 100.0 / base['value'])
+		else:
+			change = ''
+
+		status = ''
+		if regressed(result, base):
+			status = 'REGRESSED'
+			failures += 1
+
+		print('%-40s %12.3f %12.3f %8s %s' % (name, base['value'], result, change, status))
+
+	for name in sorted(set(baseline) - set(results)):
+		print('%-40s %12.3f %12s %8s missing' % (name, baseline[name]['value'], '', ''))
+		failures += 1
+
+	return failures
+
+def usage():
+	print('compare.py [-hu] [-b baseline] [-o results]')
+	print('	-h          - Display this message')
+	print('	-u          - Update the baseline with the results instead of comparing')
+	print('	-b baseline - Baseline to compare against, default bench/baseline.json')
+	print('	-o results  - File to write the results to, default bench/results.json')
+
+def main():
+	baseline_path = 'bench/baseline.json'
+	results_path = 'bench/results.json'
+	update = False
+
+	try:
+		opts, args = getopt.getopt(sys.argv[1:], 'hub:o:')
+	except getopt.GetoptError:
+		usage()
+		return 2
+
+	for opt, arg in opts:
+		if opt == '-h':
+			usage()
+			return 0
+		elif opt == '-u':
+			update = True
+		elif opt == '-b':
+			baseline_path = arg
+		elif opt == '-o':
+			results_path = arg
+
+	results = {}
+	vtbench(results)
+	memfoot(results)
+	keylat(results)
+	looptrip(results)
+	predeval(results)
+
+	with open(results_path, 'w') as f:
+		json.dump(results, f, indent=1, sort_keys=True)
+
+	if update:
+		# Keep any tolerances which were tuned by hand
+		try:
+			with open(baseline_path) as f:
+				baseline = json.load(f)
+		except (IOError, ValueError):
+			baseline = {}
+
+		for name in set(baseline) - set(results):
+			del baseline[name]
+		for name in list(filter(reported, baseline)):
+			del baseline[name]
+		for name in results:
+			if reported(name):
+				continue
+			if name not in baseline:
+				baseline[name] = defaults(name)
+			baseline[name]['value'] = results[name]
+		with open(baseline_path, 'w') as f:
+			json.dump(baseline, f, indent=1, sort_keys=True)
+		print('Updated %s' % baseline_path)
+		return 0
+
+	with open(baseline_path) as f:
+		baseline = json.load(f)
+
+	failures = compare(results, baseline)
+	if failures:
+		print('%d benchmarks regressed' % failures)
+		return 1
+
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,580 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Measure the end to end keystroke latency of tachyon: the time from a key
+ * being written to tachyon's terminal until its glyph is drawn on tachyon's
+ * stdout. Tachyon is run on a pty with and without prediction. Its shell is
+ * this program, which places the link emulator in front of a program
+ * reading the typed line, so the echo comes from the pty of a slow link.
+ * Meanwhile a second buffer in the background floods output.
+ */
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include "../src/util.h"
+
+#define KEYLAT_DEFAULT_KEYS 1000
+#define KEYLAT_DEFAULT_INTERVAL_MS 30
+#define KEYLAT_DEFAULT_DELAY_MS 50
+#define KEYLAT_DEFAULT_WARMUP 40
+
+/* Size of tachyon's terminal */
+#define KEYLAT_ROWS 24
+#define KEYLAT_COLS 80
+
+/* Keys typed before pressing enter, short enough to never wrap */
+#define KEYLAT_LINE_LEN 60
+
+/* How long to wait for a glyph before counting the key as lost */
+#define KEYLAT_TIMEOUT_US (5 * 1000 * 1000)
+
+/* How long tachyon is given to draw after starting or switching buffers */
+#define KEYLAT_SETTLE_US (500 * 1000)
+
+#define KEYLAT_MAX_PENDING 256
+
+#define META "\024"
+
+static struct {
+	char tachyon[PATH_MAX];
+	char link[PATH_MAX];
+	char self[PATH_MAX];
+	int keys;
+	int interval_ms;
+	int delay_ms;
+	int jitter_ms;
+	int warmup;
+	bool flood;
+} config = {
+	.tachyon = "./tachyon",
+	.link = "./tools/delayed_echo",
+	.keys = KEYLAT_DEFAULT_KEYS,
+	.interval_ms = KEYLAT_DEFAULT_INTERVAL_MS,
+	.delay_ms = KEYLAT_DEFAULT_DELAY_MS,
+	.jitter_ms = 0,
+	.warmup = KEYLAT_DEFAULT_WARMUP,
+	.flood = true,
+};
+
+struct key {
+	char c;
+	bool measured;
+	uint64_t sent;
+
+	/* Where the glyph of the key belongs on tachyon's terminal */
+	int row;
+	int col;
+};
+
+/*
+ * The state of a single run against one tachyon.
+ */
+struct run {
+	int fd;
+	pid_t pid;
+
+	/* Keys typed whose glyph hasn't been seen yet, oldest first */
+	struct key pending[KEYLAT_MAX_PENDING];
+	int pending_used;
+
+	/* Where the output parser is within an escape sequence */
+	enum {GROUND, ESCAPE, CSI, OSC} state;
+	int params[2];
+	int num_params;
+
+	/* Cursor position of tachyon's terminal, following its output */
+	int row;
+	int col;
+
+	uint64_t *latencies;
+	int num_latencies;
+	int lost;
+};
+
+static uint64_t now_us(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000 * 1000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Run as the shell of tachyon's buffers. The second buffer floods output
+ * while every other one runs the link emulator in front of a program which
+ * discards what's typed, leaving the pty echo as the only output.
+ */
+static int shell(char **args) {
+	static const char line[] =
+		"src/vt.c:123:45: warning: comparison between signed and unsigned integer expressions\r\n"
+		"\033[1mtotal 1234\033[0m  drwxr-xr-x  2 user user  4096 Jan  1 00:00 \033[34mdirectory\033[0m\r\n";
+	const char *window = getenv("WINDOW");
+	char *link_args[] = {args[0], "-d", args[1], "-j", args[2], "--",
+			     "/bin/sh", "-c", "cat > /dev/null", NULL};
+
+	if (window && strcmp(window, "1") == 0) {
+		for (;;)
+			if (write(1, line, sizeof(line) - 1) < 0)
+				return 0;
+	}
+
+	execv(link_args[0], link_args);
+	fprintf(stderr, "Unable to exec %s: %s\n", link_args[0], strerror(errno));
+	return 1;
+}
+
+/*
+ * Move the cursor as the final byte of a CSI sequence does. Only cursor
+ * positioning matters, tachyon doesn't use the other sequences which move
+ * the cursor.
+ */
+static void parse_csi(struct run *run, char final) {
+	int first = run->params[0] ? run->params[0] : 1;
+	int second = run->params[1] ? run->params[1] : 1;
+
+	switch (final) {
+		case 'f':
+		case 'H':
+			run->row = first - 1;
+			run->col = second - 1;
+			break;
+
+		case 'A':
+			run->row -= first;
+			break;
+
+		case 'B':
+			run->row += first;
+			break;
+
+		case 'C':
+			run->col += first;
+			break;
+
+		case 'D':
+			run->col -= first;
+			break;
+	}
+
+	run->row = max(0, min(run->row, KEYLAT_ROWS - 1));
+	run->col = max(0, min(run->col, KEYLAT_COLS - 1));
+}
+
+/*
+ * Watch the output of tachyon for the glyphs of the pending keys, skipping
+ * escape sequences since they contain printable characters. A glyph only
+ * counts when it is drawn where the key belongs, so neither a misprediction
+ * nor the same character elsewhere on the screen is taken as the key being
+ * displayed.
+ */
+static void parse(struct run *run, int len, const char *buf, uint64_t now) {
+	for (int i = 0; i < len; i++) {
+		char c = buf[i];
+
+		switch (run->state) {
+			case GROUND:
+				if (c == '\033') {
+					run->state = ESCAPE;
+				} else if (c == '\r') {
+					run->col = 0;
+				} else if (c == '\n') {
+					run->row = min(run->row + 1, KEYLAT_ROWS - 1);
+				} else if (c == '\b') {
+					run->col = max(run->col - 1, 0);
+				} else if (c >= ' ' && c <= '~') {
+					break;
+				}
+				continue;
+
+			case ESCAPE:
+				if (c == '[') {
+					run->state = CSI;
+					run->params[0] = 0;
+					run->params[1] = 0;
+					run->num_params = 0;
+				} else if (c == ']') {
+					run->state = OSC;
+				} else {
+					run->state = GROUND;
+				}
+				continue;
+
+			case CSI:
+				if (c >= '0' && c <= '9' && run->num_params < 2) {
+					run->params[run->num_params] =
+						run->params[run->num_params] * 10 + c - '0';
+				} else if (c == ';') {
+					run->num_params++;
+				} else if (c >= 0x40 && c <= 0x7e) {
+					parse_csi(run, c);
+					run->state = GROUND;
+				}
+				continue;
+
+			case OSC:
+				if (c == '\007' || c == '\033')
+					run->state = GROUND;
+				continue;
+		}
+
+		for (int k = 0; k < run->pending_used; k++) {
+			struct key *key = &run->pending[k];
+
+			if (key->c != c || key->row != run->row || key->col != run->col)
+				continue;
+
+			if (key->measured)
+				run->latencies[run->num_latencies++] = now - key->sent;
+
+			memmove(key, key + 1, (run->pending_used - k - 1) * sizeof(*key));
+			run->pending_used--;
+			break;
+		}
+
+		run->col = min(run->col + 1, KEYLAT_COLS - 1);
+	}
+}
+
+/*
+ * Read the output of tachyon until the given time, or until nothing is
+ * pending if wait_pending.
+ */
+static int pump(struct run *run, uint64_t until, bool wait_pending) {
+	struct pollfd fds = {.fd = run->fd, .events = POLLIN};
+	char buf[4096];
+	uint64_t now;
+	int len;
+
+	while ((now = now_us()) < until) {
+		if (wait_pending && run->pending_used == 0)
+			return 0;
+
+		if (poll(&fds, 1, (until - now + 999) / 1000) < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+
+		if (fds.revents & POLLIN) {
+			len = read(run->fd, buf, sizeof(buf));
+			if (len <= 0)
+				return EPIPE;
+			parse(run, len, buf, now_us());
+		} else if (fds.revents) {
+			return EPIPE;
+		}
+	}
+
+	return 0;
+}
+
+static int send_keys(struct run *run, const char *keys) {
+	int len = strlen(keys);
+
+	return write(run->fd, keys, len) == len ? 0 : EIO;
+}
+
+/*
+ * Start tachyon on a new pty.
+ *
+ * Returns 0 on success or an errno on failure.
+ */
+static int start(struct run *run, bool predict, const char *profile) {
+	struct winsize size = {KEYLAT_ROWS, KEYLAT_COLS, 0, 0};
+	char shell_cmd[3 * PATH_MAX];
+	char *tachyon_args[] = {config.tachyon, "-q", "-s", shell_cmd, "-P", (char *)profile,
+				predict ? "-p" : NULL, NULL};
+	int slave;
+
+	snprintf(shell_cmd, sizeof(shell_cmd), "%s -S %s %d %d", config.self, config.link,
+		 config.delay_ms, config.jitter_ms);
+
+	run->fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (run->fd < 0)
+		return errno;
+
+	if (grantpt(run->fd) || unlockpt(run->fd))
+		goto err_master;
+
+	slave = open(ptsname(run->fd), O_RDWR);
+	if (slave < 0)
+		goto err_master;
+	ioctl(slave, TIOCSWINSZ, &size);
+
+	run->pid = fork();
+	if (run->pid < 0) {
+		close(slave);
+		goto err_master;
+	}
+
+	if (run->pid == 0) {
+		/* Child */
+		close(run->fd);
+
+		setsid();
+		dup2(slave, 0);
+		dup2(slave, 1);
+		dup2(slave, 2);
+		if (slave > 2)
+			close(slave);
+		ioctl(0, TIOCSCTTY, 1);
+
+		execv(tachyon_args[0], tachyon_args);
+		_exit(127);
+	}
+
+	close(slave);
+	return 0;
+
+err_master:
+	close(run->fd);
+	return errno ? errno : EIO;
+}
+
+static int compare_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(struct run *run, double p) {
+	int i;
+
+	if (run->num_latencies == 0)
+		return 0;
+
+	i = p * run->num_latencies + 0.5;
+	if (i >= run->num_latencies)
+		i = run->num_latencies - 1;
+
+	return run->latencies[i] / 1000.0;
+}
+
+/*
+ * Type the keys into a fresh tachyon and report the latencies.
+ *
+ * Returns 0 on success or an errno on failure.
+ */
+static int run(bool predict) {
+	struct run run;
+	char profile[64];
+	char key[2] = "";
+	uint64_t next;
+	int result;
+	int row;
+	int col;
+
+	memset(&run, 0, sizeof(run));
+	run.latencies = calloc(config.keys, sizeof(*run.latencies));
+	if (!run.latencies)
+		return ENOMEM;
+
+	/* Start from no profile so every run learns the same way */
+	snprintf(profile, sizeof(profile), "/tmp/keylat-%d.profile", getpid());
+
+	result = start(&run, predict, profile);
+	if (result)
+		goto out_free;
+
+	result = pump(&run, now_us() + KEYLAT_SETTLE_US, false);
+
+	if (!result && config.flood) {
+		/* Create the flooding buffer then return to the first */
+		result = send_keys(&run, META "c");
+		if (!result)
+			result = pump(&run, now_us() + KEYLAT_SETTLE_US, false);
+		if (!result)
+			result = send_keys(&run, META "0");
+		if (!result)
+			result = pump(&run, now_us() + KEYLAT_SETTLE_US, false);
+	}
+
+	/* Typing starts wherever tachyon has left the cursor */
+	row = run.row;
+	col = run.col;
+
+	next = now_us();
+	for (int i = 0; !result && i < config.warmup + config.keys; i++) {
+		if (i % KEYLAT_LINE_LEN == KEYLAT_LINE_LEN - 1) {
+			/*
+			 * Enter has no glyph, so isn't measured. Keys typed
+			 * before the slave answers it aren't predicted, so
+			 * wait for the prompt as a typist would.
+			 */
+			result = send_keys(&run, "\r");
+			next += 2 * (config.delay_ms + config.jitter_ms) * 1000;
+			row = min(row + 1, KEYLAT_ROWS - 1);
+			col = 0;
+		} else if (run.pending_used < KEYLAT_MAX_PENDING) {
+			struct key *pending = &run.pending[run.pending_used++];
+
+			key[0] = 'a' + i % 26;
+			pending->c = key[0];
+			pending->measured = i >= config.warmup;
+			pending->row = row;
+			pending->col = col++;
+			pending->sent = now_us();
+			result = send_keys(&run, key);
+		}
+
+		next += config.interval_ms * 1000;
+		if (!result)
+			result = pump(&run, next, false);
+	}
+
+	if (!result)
+		result = pump(&run, now_us() + KEYLAT_TIMEOUT_US, true);
+
+	for (int k = 0; k < run.pending_used; k++)
+		if (run.pending[k].measured)
+			run.lost++;
+
+	if (!result) {
+		qsort(run.latencies, run.num_latencies, sizeof(*run.latencies), compare_u64);
+		printf("%-8s %8.1f ms %8.1f ms %8.1f ms %8.1f ms %6d\n", predict ? "on" : "off",
+		       percentile_ms(&run, 0.5), percentile_ms(&run, 0.99),
+		       percentile_ms(&run, 0.999), percentile_ms(&run, 1), run.lost);
+	}
+
+	kill(run.pid, SIGTERM);
+	waitpid(run.pid, NULL, 0);
+	close(run.fd);
+	unlink(profile);
+
+out_free:
+	free(run.latencies);
+	return result;
+}
+
+static void usage(void) {
+	printf("keylat [-hF] [-t tachyon] [-l link] [-d delay] [-j jitter] [-n keys] [-i interval] [-w keys]\n");
+	printf("	-h          - Display this message\n");
+	printf("	-F          - Don't flood output from a background buffer\n");
+	printf("	-t tachyon  - Tachyon binary to measure, default %s\n", config.tachyon);
+	printf("	-l link     - Link emulator binary, default %s\n", config.link);
+	printf("	-d delay    - One way delay of the link in milliseconds, default %d\n",
+	       KEYLAT_DEFAULT_DELAY_MS);
+	printf("	-j jitter   - Jitter of the link in milliseconds, default 0\n");
+	printf("	-n keys     - Keys measured, at least 1000 for a meaningful p99.9, default %d\n",
+	       KEYLAT_DEFAULT_KEYS);
+	printf("	-i interval - Milliseconds between keys, default %d\n",
+	       KEYLAT_DEFAULT_INTERVAL_MS);
+	printf("	-w keys     - Keys typed to warm up the predictor first, default %d\n",
+	       KEYLAT_DEFAULT_WARMUP);
+}
+
+int main(int argn, char **args) {
+	char link[PATH_MAX];
+	int result;
+	int flag;
+
+	if (argn == 5 && strcmp(args[1], "-S") == 0)
+		return shell(&args[2]);
+
+	while ((flag = getopt(argn, args, "hFt:l:d:j:n:i:w:")) != -1) {
+		switch (flag) {
+			case 'F':
+				config.flood = false;
+				break;
+
+			case 't':
+				strncpy(config.tachyon, optarg, sizeof(config.tachyon) - 1);
+				break;
+
+			case 'l':
+				strncpy(config.link, optarg, sizeof(config.link) - 1);
+				break;
+
+			case 'd':
+				config.delay_ms = atoi(optarg);
+				break;
+
+			case 'j':
+				config.jitter_ms = atoi(optarg);
+				break;
+
+			case 'n':
+				config.keys = atoi(optarg);
+				break;
+
+			case 'i':
+				config.interval_ms = atoi(optarg);
+				break;
+
+			case 'w':
+				config.warmup = atoi(optarg);
+				break;
+
+			case 'h':
+				usage();
+				return 0;
+
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (config.keys < 1 || config.interval_ms < 0 || config.delay_ms < 0 ||
+	    config.jitter_ms < 0 || config.warmup < 0) {
+		usage();
+		return 1;
+	}
+
+	/* Tachyon's shell command is split on spaces and run from anywhere */
+	if (!realpath(args[0], config.self) || !realpath(config.link, link)) {
+		fprintf(stderr, "Unable to find the link emulator: %s\n", strerror(errno));
+		return 1;
+	}
+	strcpy(config.link, link);
+
+	signal(SIGPIPE, SIG_IGN);
+	setvbuf(stdout, NULL, _IONBF, 0);
+
+	printf("link %d ms each way, %d ms jitter, %s, %d keys every %d ms\n",
+	       config.delay_ms, config.jitter_ms,
+	       config.flood ? "background flood" : "no flood",
+	       config.keys, config.interval_ms);
+	printf("%-8s %11s %11s %11s %11s %6s\n", "predict", "p50", "p99", "p99.9", "max", "lost");
+
+	for (int predict = 0; predict <= 1; predict++) {
+		result = run(predict);
+		if (result) {
+			fprintf(stderr, "Unable to run %s: %s\n", config.tachyon, strerror(result));
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Measure the cost of the event loop as the number of fds it watches
+ * grows. K pipe or pty pairs are registered with the loop and messages are
+ * ping-ponged across them by the loop callbacks, measuring the round trip
+ * with one pair busy and the rest idle, the throughput with every pair
+ * busy and the cost of deregistering and registering an fd.
+ */
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <termios.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include "../src/loop.h"
+#include "../src/histogram.h"
+#include "../src/util.h"
+#include "bench.h"
+
+#define LOOPTRIP_DEFAULT_TRIPS 10000
+#define LOOPTRIP_DEFAULT_SIZE 64
+#define LOOPTRIP_MAX_SIZE 4096
+
+/* Numbers of pairs measured when none is given */
+static const int sweep[] = {1, 4, 16, 64, 256, 1024};
+
+/*
+ * Each side of a pair reads from the fd the loop watches and writes to its
+ * own fd, which are the same fd for a pty.
+ */
+struct side {
+	struct loop_fd fd;
+	int write_fd;
+	int received;
+};
+
+struct pair {
+	struct side ping; /* Sends the messages and times the replies */
+	struct side pong; /* Echoes the messages back */
+
+	uint64_t sent;
+	int remaining;
+};
+
+static struct {
+	bool pty;
+	int size;
+	char message[LOOPTRIP_MAX_SIZE];
+
+	/* Pairs which still have round trips to make */
+	int active;
+	struct histogram latency;
+} config = {
+	.size = LOOPTRIP_DEFAULT_SIZE,
+};
+
+static uint64_t now_ns(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000 * 1000 * 1000 + now.tv_nsec;
+}
+
+static void send_message(struct side *side) {
+	if (write(side->write_fd, config.message, config.size) != config.size) {
+		fprintf(stderr, "Unable to send a whole message: %s\n", strerror(errno));
+		exit(1);
+	}
+}
+
+/*
+ * Read what has arrived of the message.
+ *
+ * Returns true once the whole message has arrived.
+ */
+static bool receive_message(struct side *side) {
+	char buf[LOOPTRIP_MAX_SIZE];
+	int result;
+
+	result = read(side->fd.fd, buf, config.size - side->received);
+	if (result < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return false;
+
+		fprintf(stderr, "Unable to read message: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	side->received += result;
+	if (side->received < config.size)
+		return false;
+
+	side->received = 0;
+	return true;
+}
+
+static void start_trip(struct pair *pair) {
+	pair->sent = now_ns();
+	send_message(&pair->ping);
+}
+
+static void ping_cb(struct loop_fd *fd, int revents) {
+	struct pair *pair = container_of(fd, struct pair, ping.fd);
+
+	if (!receive_message(&pair->ping))
+		return;
+
+	histogram_record(&config.latency, now_ns() - pair->sent);
+
+	if (--pair->remaining > 0)
+		start_trip(pair);
+	else
+		config.active--;
+}
+
+static void pong_cb(struct loop_fd *fd, int revents) {
+	struct pair *pair = container_of(fd, struct pair, pong.fd);
+
+	if (receive_message(&pair->pong))
+		send_message(&pair->pong);
+}
+
+static int nonblocking(int fd) {
+	return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/*
+ * Open a pty whose slave passes bytes through unchanged.
+ *
+ * Returns:
+ * 0  - On success
+ * -1 - On failure, with errno set
+ */
+static int open_pty(int *master, int *slave) {
+	struct termios termios;
+
+	*master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (*master < 0)
+		return -1;
+
+	if (grantpt(*master) || unlockpt(*master))
+		goto err;
+
+	*slave = open(ptsname(*master), O_RDWR | O_NOCTTY);
+	if (*slave < 0)
+		goto err;
+
+	if (tcgetattr(*slave, &termios))
+		goto err_slave;
+	cfmakeraw(&termios);
+	if (tcsetattr(*slave, TCSANOW, &termios))
+		goto err_slave;
+
+	return 0;
+
+err_slave:
+	close(*slave);
+err:
+	close(*master);
+	return -1;
+}
+
+static void open_pair(struct pair *pair) {
+	int ping_pipe[2];
+	int pong_pipe[2];
+
+	memset(pair, 0, sizeof(*pair));
+
+	if (config.pty) {
+		if (open_pty(&pair->ping.fd.fd, &pair->pong.fd.fd)) {
+			fprintf(stderr, "Unable to open pty: %s\n", strerror(errno));
+			exit(1);
+		}
+		pair->ping.write_fd = pair->ping.fd.fd;
+		pair->pong.write_fd = pair->pong.fd.fd;
+	} else {
+		if (pipe(ping_pipe) || pipe(pong_pipe)) {
+			fprintf(stderr, "Unable to open pipe: %s\n", strerror(errno));
+			exit(1);
+		}
+		pair->pong.fd.fd = ping_pipe[0];
+		pair->ping.write_fd = ping_pipe[1];
+		pair->ping.fd.fd = pong_pipe[0];
+		pair->pong.write_fd = pong_pipe[1];
+	}
+
+	nonblocking(pair->ping.fd.fd);
+	nonblocking(pair->pong.fd.fd);
+
+	pair->ping.fd.poll_flags = POLLIN;
+	pair->ping.fd.poll_callback = ping_cb;
+	pair->pong.fd.poll_flags = POLLIN;
+	pair->pong.fd.poll_callback = pong_cb;
+
+	if (loop_register(&pair->ping.fd) || loop_register(&pair->pong.fd)) {
+		fprintf(stderr, "Unable to register with the loop\n");
+		exit(1);
+	}
+}
+
+static void close_pair(struct pair *pair) {
+	loop_deregister(&pair->ping.fd);
+	loop_deregister(&pair->pong.fd);
+
+	close(pair->ping.fd.fd);
+	close(pair->pong.fd.fd);
+	if (!config.pty) {
+		close(pair->ping.write_fd);
+		close(pair->pong.write_fd);
+	}
+}
+
+/*
+ * Make the given round trips spread over the given pairs, running the loop
+ * until they are all done.
+ *
+ * Returns the nanoseconds taken.
+ */
+static uint64_t run_trips(struct pair *pairs, int num_pairs, int trips) {
+	uint64_t start;
+
+	memset(&config.latency, 0, sizeof(config.latency));
+	config.active = num_pairs;
+
+	start = now_ns();
+
+	for (int i = 0; i < num_pairs; i++) {
+		pairs[i].remaining = trips / num_pairs + (i < trips % num_pairs);
+		if (pairs[i].remaining)
+			start_trip(&pairs[i]);
+		else
+			config.active--;
+	}
+
+	while (config.active > 0) {
+		if (!loop_run()) {
+			fprintf(stderr, "Running the loop failed\n");
+			exit(1);
+		}
+	}
+
+	return now_ns() - start;
+}
+
+/*
+ * Returns the nanoseconds taken to deregister and register again an fd
+ * watched by the loop, on average over the given number of times.
+ */
+static double run_churn(struct pair *pairs, int num_pairs, int times) {
+	uint64_t start = now_ns();
+	struct loop_fd *fd;
+
+	for (int i = 0; i < times; i++) {
+		fd = &pairs[i % num_pairs].pong.fd;
+		loop_deregister(fd);
+		loop_register(fd);
+	}
+
+	return (double)(now_ns() - start) / times;
+}
+
+static void measure(int num_pairs, int trips) {
+	struct pair *pairs;
+	uint64_t elapsed;
+	double idle_p50;
+	double idle_p99;
+
+	pairs = calloc(num_pairs, sizeof(*pairs));
+	if (!pairs) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < num_pairs; i++)
+		open_pair(&pairs[i]);
+
+	/* One pair busy while the rest are watched but idle */
+	run_trips(pairs, 1, trips);
+	idle_p50 = histogram_percentile(&config.latency, 0.5) / 1000.0;
+	idle_p99 = histogram_percentile(&config.latency, 0.99) / 1000.0;
+
+	/* Every pair busy at once */
+	elapsed = run_trips(pairs, num_pairs, max(trips, num_pairs));
+
+	printf("%5d %11.1f %11.1f %13.0f %11.1f %11.1f\n", num_pairs, idle_p50, idle_p99,
+	       config.latency.count / (elapsed / 1e9),
+	       histogram_percentile(&config.latency, 0.5) / 1000.0,
+	       run_churn(pairs, num_pairs, trips));
+
+	for (int i = 0; i < num_pairs; i++)
+		close_pair(&pairs[i]);
+	free(pairs);
+}
+
+/*
+ * Allow as many fds as permitted, each pipe pair takes four.
+ */
+static void raise_fd_limit(void) {
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit))
+		return;
+
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+static void usage(void) {
+	printf("looptrip [-hp] [-k pairs] [-n trips] [-s size]\n");
+	printf("	-h       - Display this message\n");
+	printf("	-p       - Use pty pairs instead of pipes\n");
+	printf("	-k pairs - Only measure this many pairs, by default up to %d are\n",
+	       sweep[sizeof(sweep) / sizeof(*sweep) - 1]);
+	printf("	           measured\n");
+	printf("	-n trips - Round trips made in each measurement, default %d\n",
+	       LOOPTRIP_DEFAULT_TRIPS);
+	printf("	-s size  - Bytes in each message, default %d\n", LOOPTRIP_DEFAULT_SIZE);
+}
+
+int main(int argn, char **args) {
+	const int *pairs = sweep;
+	int num_sweep = sizeof(sweep) / sizeof(*sweep);
+	int trips = LOOPTRIP_DEFAULT_TRIPS;
+	int k = 0;
+	int flag;
+
+	while ((flag = getopt(argn, args, "hpk:n:s:")) != -1) {
+		switch (flag) {
+			case 'p':
+				config.pty = true;
+				break;
+
+			case 'k':
+				k = atoi(optarg);
+				break;
+
+			case 'n':
+				trips = atoi(optarg);
+				break;
+
+			case 's':
+				config.size = atoi(optarg);
+				break;
+
+			case 'h':
+				usage();
+				return 0;
+
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (k < 0 || trips < 1 || config.size < 1 || config.size > LOOPTRIP_MAX_SIZE) {
+		usage();
+		return 1;
+	}
+
+	if (k) {
+		pairs = &k;
+		num_sweep = 1;
+	}
+
+	raise_fd_limit();
+	memset(config.message, 'x', config.size);
+
+	/* poll() is the only backend the loop has */
+	printf("poll loop, %s pairs, %d byte messages, %d round trips\n",
+	       config.pty ? "pty" : "pipe", config.size, trips);
+	printf("%5s %11s %11s %13s %11s %11s\n", "pairs", "idle p50", "idle p99", "busy trips/s",
+	       "busy p50", "churn");
+	printf("%5s %11s %11s %13s %11s %11s\n", "", "us", "us", "", "us", "ns");
+
+	for (int i = 0; i < num_sweep; i++)
+		measure(pairs[i], trips);
+
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Measure the memory held by buffers and their scroll buffers. Headless
+ * buffers are filled with lines resembling shell output at a range of
+ * widths and the heap bytes accounted by the allocator and the growth of
+ * the resident set are reported per line and per cell.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <getopt.h>
+
+#include "../src/buffer.h"
+#include "../src/vt.h"
+#include "../src/alloc.h"
+#include "../src/config.h"
+#include "bench.h"
+
+#define MEMFOOT_DEFAULT_BUFFERS 8
+#define MEMFOOT_DEFAULT_LINES 10000
+
+/* Widths measured when none is given */
+static const int widths[] = {40, 80, 132, 256, MAX_COLUMNS};
+
+/* Deterministic so every run holds the same lines */
+static unsigned int seed = 1;
+
+static unsigned int rand_below(unsigned int n) {
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) % n;
+}
+
+static const char *words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy",
+	"dog", "buffer", "terminal", "predictor", "scroll", "cursor", "a", "of", "to"};
+
+/*
+ * Feed one line of between a quarter and all of the columns to the buffer,
+ * now and then colored as ls or a compiler would.
+ *
+ * Returns the number of printable characters output.
+ */
+static size_t output_line(struct buffer *buffer, int cols) {
+	char line[MAX_COLUMNS * 2];
+	int len = cols / 4 + rand_below(cols - cols / 4);
+	int used = 0;
+	size_t printed = 0;
+	const char *word;
+	int n;
+
+	while (used < len) {
+		word = words[rand_below(sizeof(words) / sizeof(*words))];
+		if (used + strlen(word) + 1 > len)
+			break;
+
+		if (rand_below(8) == 0)
+			n = snprintf(line, sizeof(line), "\033[01;3%um%s\033[0m ", 1 + rand_below(6), word);
+		else
+			n = snprintf(line, sizeof(line), "%s ", word);
+
+		for (int i = 0; i < n; i++)
+			vt_interpret(buffer, line[i]);
+
+		used += strlen(word) + 1;
+		printed += strlen(word) + 1;
+	}
+
+	vt_interpret(buffer, '\r');
+	vt_interpret(buffer, '\n');
+
+	return printed;
+}
+
+/*
+ * Returns the resident set size of this process in bytes.
+ */
+static size_t rss_bytes(void) {
+	FILE *file;
+	unsigned long size;
+	unsigned long resident = 0;
+
+	file = fopen("/proc/self/statm", "r");
+	if (!file)
+		return 0;
+
+	if (fscanf(file, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(file);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Fill the buffers at the given width and print what they hold. Run in its
+ * own process so the resident set isn't flattered by memory freed by the
+ * previous width.
+ */
+static void measure(int num_buffers, int lines, int rows, int cols) {
+	struct buffer **buffers;
+	size_t rss = rss_bytes();
+	uint64_t heap = alloc_bytes();
+	size_t held = 0;
+	size_t printed = 0;
+
+	buffers = calloc(num_buffers, sizeof(*buffers));
+	if (!buffers) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < num_buffers; i++) {
+		buffers[i] = buffer_init_detached(i, rows, cols);
+		if (!buffers[i]) {
+			fprintf(stderr, "Unable to create buffer\n");
+			exit(1);
+		}
+
+		for (int j = 0; j < lines; j++)
+			printed += output_line(buffers[i], cols);
+
+		held += buffers[i]->vt.scrollback.len;
+	}
+
+	heap = alloc_bytes() - heap;
+	rss = rss_bytes() - rss;
+
+	printf("%5d %8zu %10zu %10zu %10.1f %8.2f %8.2f\n", cols, held, rss / 1024,
+	       (size_t)(heap / 1024), (double)heap / held, (double)heap / (held * cols),
+	       (double)heap / printed);
+}
+
+static void usage(void) {
+	printf("memfoot [-h] [-n buffers] [-m lines] [-r rows] [-c cols]\n");
+	printf("	-h         - Display this message\n");
+	printf("	-n buffers - Buffers to fill, default %d\n", MEMFOOT_DEFAULT_BUFFERS);
+	printf("	-m lines   - Lines output to each buffer, default %d\n", MEMFOOT_DEFAULT_LINES);
+	printf("	-r rows    - Rows of the emulation, default 24\n");
+	printf("	-c cols    - Only measure this width, by default widths up to %d\n",
+	       MAX_COLUMNS);
+	printf("	             are measured\n");
+}
+
+int main(int argn, char **args) {
+	int num_buffers = MEMFOOT_DEFAULT_BUFFERS;
+	int lines = MEMFOOT_DEFAULT_LINES;
+	int rows = 24;
+	int cols = 0;
+	const int *sweep = widths;
+	int num_widths = sizeof(widths) / sizeof(*widths);
+	int status;
+	int flag;
+	pid_t pid;
+
+	while ((flag = getopt(argn, args, "hn:m:r:c:")) != -1) {
+		switch (flag) {
+			case 'n':
+				num_buffers = atoi(optarg);
+				break;
+
+			case 'm':
+				lines = atoi(optarg);
+				break;
+
+			case 'r':
+				rows = atoi(optarg);
+				break;
+
+			case 'c':
+				cols = atoi(optarg);
+				break;
+
+			case 'h':
+				usage();
+				return 0;
+
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (num_buffers < 1 || lines < 1 || rows < 1 || cols < 0 || cols > MAX_COLUMNS) {
+		usage();
+		return 1;
+	}
+
+	printf("%d buffers of %d lines\n", num_buffers, lines);
+	printf("%5s %8s %10s %10s %10s %8s %8s\n", "cols", "lines", "rss KiB", "heap KiB",
+	       "B/line", "B/cell", "B/char");
+	fflush(stdout);
+
+	if (cols) {
+		sweep = &cols;
+		num_widths = 1;
+	}
+
+	for (int i = 0; i < num_widths; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+
+		if (pid == 0) {
+			measure(num_buffers, lines, rows, sweep[i]);
+			return 0;
+		}
+
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			return 1;
+	}
+
+	return 0;
+}
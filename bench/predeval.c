@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Evaluate the predictor offline against a session recorded with
+ * --record-input. The keystrokes and slave output of one buffer are
+ * replayed through the predictor under a virtual clock, with the slave
+ * output delayed by a simulated round trip time, and the accuracy of the
+ * predictions is reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "../src/buffer.h"
+#include "../src/predictor.h"
+#include "../src/record.h"
+#include "bench.h"
+
+#define PREDEVAL_DEFAULT_RTT_MS 100
+
+struct trace_event {
+	uint64_t time;
+	int len;
+	char *data;
+};
+
+struct trace {
+	int num_input;
+	struct trace_event *input;
+	int num_output;
+	struct trace_event *output;
+	int rows;
+	int cols;
+};
+
+static int trace_append(struct trace_event **events, int *num, uint64_t time, int len, char *data) {
+	struct trace_event *tmp;
+
+	tmp = realloc(*events, (*num + 1) * sizeof(**events));
+	if (!tmp)
+		return ENOMEM;
+	*events = tmp;
+
+	tmp = &(*events)[*num];
+	tmp->time = time;
+	tmp->len = len;
+	tmp->data = malloc(len);
+	if (!tmp->data)
+		return ENOMEM;
+	memcpy(tmp->data, data, len);
+	(*num)++;
+
+	return 0;
+}
+
+/*
+ * Returns the first buffer typed into in the recording, or -1 if there is
+ * none, leaving the recording positioned at the first event.
+ */
+static int trace_find_buffer(FILE *file, char *data, int size) {
+	struct record_event event;
+	int bufid = -1;
+
+	while (record_read(file, &event, data, size) == 0) {
+		if (event.type == RECORD_INPUT) {
+			bufid = event.bufid;
+			break;
+		}
+	}
+
+	fseek(file, 0, SEEK_SET);
+	record_read_header(file);
+
+	return bufid;
+}
+
+/*
+ * Load the events of the given buffer from a recording, or of the first
+ * buffer with recorded input if bufid is negative. Times are made relative
+ * to the first event.
+ *
+ * Returns:
+ * 0      - On success
+ * ENOENT - The recording couldn't be opened
+ * EINVAL - The file isn't a valid recording
+ * ENOMEM - Out of memory
+ */
+static int trace_load(const char *path, int bufid, struct trace *trace) {
+	struct record_event event;
+	struct record_size size;
+	static char data[64 * 1024];
+	uint64_t start = 0;
+	FILE *file;
+	int result;
+
+	memset(trace, 0, sizeof(*trace));
+	trace->rows = 24;
+	trace->cols = 80;
+
+	file = fopen(path, "rb");
+	if (!file)
+		return ENOENT;
+
+	result = record_read_header(file);
+	if (result)
+		goto out;
+
+	if (bufid < 0)
+		bufid = trace_find_buffer(file, data, sizeof(data));
+
+	while ((result = record_read(file, &event, data, sizeof(data))) == 0) {
+		if (start == 0)
+			start = event.time;
+
+		if (event.bufid != bufid)
+			continue;
+
+		if (event.type == RECORD_INPUT)
+			result = trace_append(&trace->input, &trace->num_input, event.time - start,
+					      event.len, data);
+		else if (event.type == RECORD_OUTPUT)
+			result = trace_append(&trace->output, &trace->num_output, event.time - start,
+					      event.len, data);
+		else if (event.type == RECORD_RESIZE && event.len == sizeof(size) &&
+			 trace->num_input == 0 && trace->num_output == 0) {
+			/* The emulation can't be resized, use the initial size */
+			memcpy(&size, data, sizeof(size));
+			trace->rows = size.rows;
+			trace->cols = size.cols;
+		}
+
+		if (result)
+			goto out;
+	}
+
+	if (result == ENOENT)
+		result = 0;
+
+out:
+	fclose(file);
+	return result;
+}
+
+static int send_input(struct buffer *buffer, int size, char *buf) {
+	return 0;
+}
+
+/*
+ * Replay the trace through the predictor, delaying the slave output by the
+ * given round trip time.
+ */
+static void evaluate(struct buffer *buffer, struct trace *trace, uint64_t rtt) {
+	struct trace_event *event;
+	int in = 0;
+	int out = 0;
+	uint64_t time;
+
+	while (in < trace->num_input || out < trace->num_output) {
+		if (out == trace->num_output ||
+		    (in < trace->num_input && trace->input[in].time <= trace->output[out].time + rtt)) {
+			event = &trace->input[in++];
+			time = event->time;
+		} else {
+			event = &trace->output[out++];
+			time = event->time + rtt;
+		}
+
+		bench_run_timer(buffer, time);
+		vclock_set(time);
+
+		if (event >= trace->input && event < trace->input + trace->num_input)
+			predictor_output(&buffer->predictor, buffer, event->len, event->data,
+					 send_input);
+		else
+			predictor_learn(&buffer->predictor, buffer, event->len, event->data);
+	}
+
+	bench_run_timer(buffer, UINT64_MAX);
+}
+
+static void report(struct predictor_stats *stats, uint64_t rtt) {
+	unsigned long judged = stats->confirmed + stats->mispredicted;
+
+	printf("keys               %lu\n", stats->keys);
+	printf("predicted keys     %lu (%.1f%% coverage)\n", stats->predicted,
+	       stats->keys ? 100.0 * stats->predicted / stats->keys : 0.0);
+	printf("confirmed cells    %lu\n", stats->confirmed);
+	printf("mispredicted cells %lu (%.1f%% accuracy)\n", stats->mispredicted,
+	       judged ? 100.0 * stats->confirmed / judged : 0.0);
+	printf("undo bytes         %lu\n", stats->undo_bytes);
+	printf("time to display    %.1f ms mean, echo takes %.1f ms\n",
+	       stats->confirmed ? stats->display_us / 1000.0 / stats->confirmed : 0.0,
+	       rtt / 1000.0);
+}
+
+static void usage(void) {
+	printf("predeval [-h] [-r rtt] [-b bufid] recording\n");
+	printf("	-h          - Display this message\n");
+	printf("	-r rtt      - Simulated round trip time in milliseconds, default %d\n",
+	       PREDEVAL_DEFAULT_RTT_MS);
+	printf("	-b bufid    - Buffer to evaluate, default the first one typed into\n");
+}
+
+int main(int argn, char **args) {
+	struct buffer *buffer;
+	struct trace trace;
+	uint64_t rtt = PREDEVAL_DEFAULT_RTT_MS * 1000;
+	int bufid = -1;
+	int result;
+	int flag;
+
+	while ((flag = getopt(argn, args, "hr:b:")) != -1) {
+		switch (flag) {
+			case 'r':
+				rtt = strtoull(optarg, NULL, 10) * 1000;
+				break;
+
+			case 'b':
+				bufid = atoi(optarg);
+				break;
+
+			case 'h':
+				usage();
+				return 0;
+
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (optind != argn - 1) {
+		usage();
+		return 1;
+	}
+
+	result = trace_load(args[optind], bufid, &trace);
+	if (result) {
+		fprintf(stderr, "Unable to load recording '%s': %s\n", args[optind], strerror(result));
+		return 1;
+	}
+
+	if (trace.num_input == 0) {
+		fprintf(stderr, "No input recorded, record with --record-input\n");
+		return 1;
+	}
+
+	buffer = buffer_init_detached(0, trace.rows, trace.cols);
+	if (!buffer) {
+		fprintf(stderr, "Unable to create buffer\n");
+		return 1;
+	}
+
+	evaluate(buffer, &trace, rtt);
+	report(&buffer->predictor.stats, rtt);
+
+	return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Stand-ins for the controller and the parts of tachyon.c the buffers
+ * depend on, so buffers can be driven without a terminal.
+ */
+
+#include <stdbool.h>
+#include <limits.h>
+
+#include "../src/options.h"
+#include "../src/buffer.h"
+#include "../src/predictor.h"
+#include "bench.h"
+
+struct cmd_options cmd_options = {
+	.predict = true,
+	.verbose = 0,
+};
+
+unsigned long bench_controller_bytes;
+
+int controller_output(int bufid, int size, const char *buf) {
+	bench_controller_bytes += size;
+	return 0;
+}
+
+int controller_output_space(void) {
+	return INT_MAX;
+}
+
+void controller_mark_output(int bufid, uint64_t time) {
+}
+
+void controller_enforce_memory_budget(void) {
+}
+
+void controller_buffer_exiting(int bufid) {
+}
+
+/*
+ * Fire the prediction timer of the buffer if it is due by the given time,
+ * moving the clock to when it fires.
+ */
+void bench_run_timer(struct buffer *buffer, uint64_t now) {
+	struct loop_timer *timer = &buffer->predictor.timer;
+
+	while (timer->deadline && timer->deadline <= now) {
+		vclock_set(timer->deadline);
+		timer->deadline = 0;
+		timer->timer_callback(timer);
+	}
+}
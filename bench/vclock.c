@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * A virtual clock which replaces src/clock.c in the benchmarks, so time
+ * only moves when the benchmark says it does.
+ */
+
+#include "../src/clock.h"
+#include "bench.h"
+
+static uint64_t virtual_now;
+
+void vclock_set(uint64_t now) {
+	virtual_now = now;
+}
+
+uint64_t clock_now_us(void) {
+	return virtual_now;
+}
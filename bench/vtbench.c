@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Measure the throughput of the terminal emulation. Byte corpora, either
+ * generated to resemble common kinds of output or read from files, are fed
+ * through buffer_input() without a slave or controller. Allocations made
+ * by the emulation are counted by wrapping malloc() at link time and the
+ * bytes drawn to the terminal by the controller stub, with the bytes of
+ * full redraws, such as scrolling back into the scroll buffer causes, also
+ * counted on their own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "../src/buffer.h"
+#include "../src/vt.h"
+#include "../src/predictor.h"
+#include "../src/options.h"
+#include "../src/alloc.h"
+#include "bench.h"
+
+#define VTBENCH_DEFAULT_MB 4
+#define VTBENCH_DEFAULT_RUNS 3
+
+/* Scroll buffer limit used when checking for allocations if none is given */
+#define VTBENCH_STEADY_SCROLLBACK 1000
+
+/* Bytes handed over at a time, as read() from the slave would */
+#define VTBENCH_READ_SIZE 1024
+
+struct corpus {
+	const char *name;
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+/*
+ * Allocations are only counted while the emulation runs.
+ */
+static bool counting;
+static unsigned long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	if (counting)
+		allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+	if (counting)
+		allocations++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	if (counting)
+		allocations++;
+	return __real_realloc(ptr, size);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000 * 1000 * 1000 + now.tv_nsec;
+}
+
+/* Deterministic so every run measures the same bytes */
+static unsigned int seed = 1;
+
+static unsigned int rand_below(unsigned int n) {
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) % n;
+}
+
+static void append(struct corpus *corpus, const char *fmt, ...) {
+	va_list args;
+	int len;
+
+	for (;;) {
+		va_start(args, fmt);
+		len = vsnprintf(corpus->data + corpus->len, corpus->size - corpus->len, fmt, args);
+		va_end(args);
+
+		if (len < corpus->size - corpus->len)
+			break;
+
+		corpus->size = corpus->size * 2 + len;
+		corpus->data = realloc(corpus->data, corpus->size);
+		if (!corpus->data) {
+			fprintf(stderr, "Out of memory generating corpus\n");
+			exit(1);
+		}
+	}
+
+	corpus->len += len;
+}
+
+static const char *words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy",
+	"dog", "buffer", "terminal", "predictor", "scroll", "cursor", "a", "of", "to"};
+
+static void append_words(struct corpus *corpus, int len) {
+	int used = 0;
+	const char *word;
+
+	while (used < len) {
+		word = words[rand_below(sizeof(words) / sizeof(*words))];
+		append(corpus, "%s ", word);
+		used += strlen(word) + 1;
+	}
+}
+
+/* Plain text, such as cat of a source file */
+static void gen_ascii(struct corpus *corpus) {
+	append_words(corpus, 20 + rand_below(60));
+	append(corpus, "\r\n");
+}
+
+/* Colored ls output */
+static void gen_ls(struct corpus *corpus) {
+	static const char *colors[] = {"0", "01;34", "01;32", "01;36", "00;33"};
+
+	for (int i = 0; i < 5; i++)
+		append(corpus, "\033[%sm%s_%u\033[0m  ", colors[rand_below(5)],
+		       words[rand_below(sizeof(words) / sizeof(*words))], rand_below(1000));
+	append(corpus, "\r\n");
+}
+
+/* Compiler diagnostics */
+static void gen_compiler(struct corpus *corpus) {
+	int line = rand_below(2000);
+	int col = rand_below(60);
+
+	append(corpus, "\033[1msrc/%s.c:%d:%d:\033[m \033[1;35mwarning:\033[m unused variable "
+	       "'\033[1m%s\033[m' [\033[1;35m-Wunused-variable\033[m]\r\n",
+	       words[rand_below(16)], line, col, words[rand_below(16)]);
+	append(corpus, " %5d |   int %s;\r\n", line, words[rand_below(16)]);
+	append(corpus, "       | %*s\033[1;35m^\033[m\r\n", col % 40, "");
+}
+
+/* Full screen redraws in the style of top */
+static void gen_top(struct corpus *corpus) {
+	append(corpus, "\033[f\033[7m  PID USER      PR  NI    VIRT    RES  %%CPU  COMMAND"
+	       "\033[K\033[m\r\n");
+	for (int row = 1; row < 24; row++)
+		append(corpus, "%5u %-8s  20   0 %7u %6u %5u.%u %s\033[K%s", rand_below(99999),
+		       words[rand_below(16)], rand_below(9999999), rand_below(999999),
+		       rand_below(100), rand_below(10), words[rand_below(16)],
+		       row < 23 ? "\r\n" : "");
+	append(corpus, "\033[J");
+}
+
+/* Dense cursor movement and attribute changes, as full screen editors emit */
+static void gen_escape(struct corpus *corpus) {
+	append(corpus, "\033[%u;%uf\033[%u;3%um%c\033[0m\033[%uC\033[K", 1 + rand_below(24),
+	       1 + rand_below(80), rand_below(8), rand_below(8), 'a' + rand_below(26),
+	       rand_below(5));
+}
+
+/*
+ * Scrolling forwards at the bottom and back with reverse index at the top,
+ * as a pager which doesn't use the alternate screen does. Slightly more is
+ * scrolled back than forwards, so it scrolls back into the scroll buffer
+ * and then beyond its top.
+ */
+static void gen_reverse(struct corpus *corpus) {
+	int lines = 1 + rand_below(20);
+
+	append(corpus, "\033[999;1f");
+	for (int i = 0; i < lines; i++) {
+		append(corpus, "\r\n");
+		append_words(corpus, 20 + rand_below(50));
+	}
+
+	append(corpus, "\033[f");
+	for (int i = 0; i < lines + rand_below(3); i++) {
+		append(corpus, "\033M\r");
+		append_words(corpus, 20 + rand_below(50));
+	}
+}
+
+static void generate(struct corpus *corpus, const char *name, size_t size,
+		     void (*gen)(struct corpus *corpus)) {
+	memset(corpus, 0, sizeof(*corpus));
+	corpus->name = name;
+
+	while (corpus->len < size)
+		gen(corpus);
+}
+
+static int load(struct corpus *corpus, const char *path) {
+	FILE *file;
+	long len;
+
+	memset(corpus, 0, sizeof(*corpus));
+	corpus->name = path;
+
+	file = fopen(path, "rb");
+	if (!file)
+		return 1;
+
+	fseek(file, 0, SEEK_END);
+	len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	corpus->data = malloc(len);
+	if (!corpus->data || fread(corpus->data, 1, len, file) != len) {
+		fclose(file);
+		return 1;
+	}
+	corpus->len = len;
+
+	fclose(file);
+	return 0;
+}
+
+/*
+ * Run the corpus through a fresh emulation the given number of times and
+ * report the fastest run.
+ */
+static void run(struct corpus *corpus, int runs, int rows, int cols) {
+	struct buffer *buffer;
+	uint64_t best = UINT64_MAX;
+	uint64_t start;
+	uint64_t elapsed;
+	unsigned long allocs = 0;
+	unsigned long output = 0;
+	uint64_t redraw = 0;
+	int len;
+	double mb = corpus->len / (1024.0 * 1024.0);
+
+	for (int i = 0; i < runs; i++) {
+		buffer = buffer_init_detached(0, rows, cols);
+		if (!buffer) {
+			fprintf(stderr, "Unable to create buffer\n");
+			exit(1);
+		}
+
+		allocations = 0;
+		bench_controller_bytes = 0;
+		counting = true;
+		start = now_ns();
+
+		for (size_t j = 0; j < corpus->len; j += len) {
+			len = min(corpus->len - j, VTBENCH_READ_SIZE);
+			buffer_input(buffer, len, corpus->data + j);
+		}
+
+		elapsed = now_ns() - start;
+		counting = false;
+
+		if (elapsed < best) {
+			best = elapsed;
+			allocs = allocations;
+			output = bench_controller_bytes;
+			redraw = buffer->stats.redraw_bytes;
+		}
+
+		buffer_free(buffer);
+	}
+
+	printf("%-12s %8.1f MB/s %8.2f ns/byte %10.1f allocs/MB %8.3f out/byte %8.3f redraw/byte\n",
+	       corpus->name, mb / (best / 1e9), (double)best / corpus->len, allocs / mb,
+	       (double)output / corpus->len, (double)redraw / corpus->len);
+}
+
+/*
+ * Check that once warmed up, output passing from the slave through the
+ * emulation to the controller allocates nothing. The corpus is fed through
+ * a buffer twice and only the second pass is counted.
+ *
+ * Returns the number of allocations made after warming up.
+ */
+static unsigned long steady(struct corpus *corpus, int rows, int cols) {
+	struct buffer *buffer;
+	unsigned long allocs;
+	int len;
+
+	buffer = buffer_init_detached(0, rows, cols);
+	if (!buffer) {
+		fprintf(stderr, "Unable to create buffer\n");
+		exit(1);
+	}
+
+	for (int pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			allocations = 0;
+			counting = true;
+		}
+
+		for (size_t j = 0; j < corpus->len; j += len) {
+			len = min(corpus->len - j, VTBENCH_READ_SIZE);
+			predictor_learn(&buffer->predictor, buffer, len, corpus->data + j);
+		}
+	}
+
+	counting = false;
+	allocs = allocations;
+
+	printf("%-12s %10lu allocs after warm up %s\n", corpus->name, allocs,
+	       allocs ? "FAIL" : "ok");
+	/* Show which part of tachyon is allocating */
+	if (allocs)
+		alloc_print(stdout);
+
+	buffer_free(buffer);
+
+	return allocs;
+}
+
+static void usage(void) {
+	printf("vtbench [-hz] [-s MB] [-n runs] [-r rows] [-c cols] [-b lines] [file...]\n");
+	printf("	-h       - Display this message\n");
+	printf("	-s MB    - Size of each generated corpus, default %d\n", VTBENCH_DEFAULT_MB);
+	printf("	-n runs  - Runs of each corpus, the fastest is reported, default %d\n",
+	       VTBENCH_DEFAULT_RUNS);
+	printf("	-r rows  - Rows of the emulation, default 24\n");
+	printf("	-c cols  - Columns of the emulation, default 80\n");
+	printf("	-b lines - Lines kept in the scroll buffer, default unlimited\n");
+	printf("	-z       - Instead check nothing is allocated once warmed up, exiting\n");
+	printf("	           with failure if anything is. The scroll buffer defaults to %d\n",
+	       VTBENCH_STEADY_SCROLLBACK);
+	printf("Files given are used as the corpora instead of the generated ones\n");
+}
+
+int main(int argn, char **args) {
+	static const struct {
+		const char *name;
+		void (*gen)(struct corpus *corpus);
+	} generators[] = {
+		{"ascii", gen_ascii},
+		{"ls", gen_ls},
+		{"compiler", gen_compiler},
+		{"top", gen_top},
+		{"escape", gen_escape},
+		{"reverse", gen_reverse},
+	};
+	struct corpus corpus;
+	size_t size = VTBENCH_DEFAULT_MB * 1024 * 1024;
+	int runs = VTBENCH_DEFAULT_RUNS;
+	int rows = 24;
+	int cols = 80;
+	bool check_steady = false;
+	unsigned long failures = 0;
+	int flag;
+
+	while ((flag = getopt(argn, args, "hs:n:r:c:b:z")) != -1) {
+		switch (flag) {
+			case 's':
+				size = strtoul(optarg, NULL, 10) * 1024 * 1024;
+				break;
+
+			case 'n':
+				runs = atoi(optarg);
+				break;
+
+			case 'r':
+				rows = atoi(optarg);
+				break;
+
+			case 'c':
+				cols = atoi(optarg);
+				break;
+
+			case 'b':
+				cmd_options.scrollback_lines = atoi(optarg);
+				break;
+
+			case 'z':
+				check_steady = true;
+				break;
+
+			case 'h':
+				usage();
+				return 0;
+
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (runs < 1 || rows < 1 || cols < 1) {
+		usage();
+		return 1;
+	}
+
+	if (check_steady && cmd_options.scrollback_lines == 0)
+		cmd_options.scrollback_lines = VTBENCH_STEADY_SCROLLBACK;
+
+	if (optind < argn) {
+		for (int i = optind; i < argn; i++) {
+			if (load(&corpus, args[i])) {
+				fprintf(stderr, "Unable to read corpus '%s'\n", args[i]);
+				return 1;
+			}
+			if (check_steady)
+				failures += steady(&corpus, rows, cols);
+			else
+				run(&corpus, runs, rows, cols);
+			free(corpus.data);
+		}
+	} else {
+		for (int i = 0; i < sizeof(generators) / sizeof(*generators); i++) {
+			generate(&corpus, generators[i].name, size, generators[i].gen);
+			if (check_steady)
+				failures += steady(&corpus, rows, cols);
+			else
+				run(&corpus, runs, rows, cols);
+			free(corpus.data);
+		}
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * The accounted allocator. Each block is preceded by a header holding its
+ * size so the bytes held can be counted when it is freed. Memory from
+ * these functions must only be freed or reallocated by them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "alloc.h"
+
+/* Keeps the memory after the header aligned for any type */
+union alloc_header {
+	size_t size;
+	long double align;
+};
+
+struct alloc_counters alloc_counters[ALLOC_TAG_MAX];
+
+static const char *alloc_names[ALLOC_TAG_MAX] = {
+	[ALLOC_BUFFER] = "buffer",
+	[ALLOC_VT] = "vt",
+	[ALLOC_SCROLLBACK] = "scrollback",
+	[ALLOC_LOOP] = "loop",
+};
+
+void *alloc_malloc(enum alloc_tag tag, size_t size) {
+	union alloc_header *header;
+
+	if (size > SIZE_MAX - sizeof(*header))
+		return NULL;
+
+	header = malloc(sizeof(*header) + size);
+	if (!header)
+		return NULL;
+
+	header->size = size;
+	alloc_counters[tag].allocs++;
+	alloc_counters[tag].bytes += size;
+
+	return header + 1;
+}
+
+void *alloc_calloc(enum alloc_tag tag, size_t nmemb, size_t size) {
+	void *ptr;
+
+	if (size != 0 && nmemb > SIZE_MAX / size)
+		return NULL;
+
+	ptr = alloc_malloc(tag, nmemb * size);
+	if (ptr)
+		memset(ptr, 0, nmemb * size);
+
+	return ptr;
+}
+
+void *alloc_realloc(enum alloc_tag tag, void *ptr, size_t size) {
+	union alloc_header *header;
+	size_t old_size;
+
+	if (!ptr)
+		return alloc_malloc(tag, size);
+
+	if (size > SIZE_MAX - sizeof(*header))
+		return NULL;
+
+	header = (union alloc_header *)ptr - 1;
+	old_size = header->size;
+
+	header = realloc(header, sizeof(*header) + size);
+	if (!header)
+		return NULL;
+
+	header->size = size;
+	alloc_counters[tag].allocs++;
+	alloc_counters[tag].bytes += size - old_size;
+
+	return header + 1;
+}
+
+void alloc_free(enum alloc_tag tag, void *ptr) {
+	union alloc_header *header;
+
+	if (!ptr)
+		return;
+
+	header = (union alloc_header *)ptr - 1;
+	alloc_counters[tag].frees++;
+	alloc_counters[tag].bytes -= header->size;
+
+	free(header);
+}
+
+/*
+ * Returns the number of allocations made by every part of tachyon.
+ */
+uint64_t alloc_total(void) {
+	uint64_t total = 0;
+
+	for (int i = 0; i < ALLOC_TAG_MAX; i++)
+		total += alloc_counters[i].allocs;
+
+	return total;
+}
+
+/*
+ * Returns the bytes currently allocated by every part of tachyon.
+ */
+uint64_t alloc_bytes(void) {
+	uint64_t bytes = 0;
+
+	for (int i = 0; i < ALLOC_TAG_MAX; i++)
+		bytes += alloc_counters[i].bytes;
+
+	return bytes;
+}
+
+/*
+ * Print the counters of every tag in a human readable form.
+ */
+void alloc_print(FILE *file) {
+	for (int i = 0; i < ALLOC_TAG_MAX; i++)
+		fprintf(file, "alloc %-14s %" PRIu64 " allocs %" PRIu64 " frees %" PRIu64 " bytes\n",
+			alloc_names[i], alloc_counters[i].allocs, alloc_counters[i].frees,
+			alloc_counters[i].bytes);
+}
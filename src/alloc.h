@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Header for the accounted allocator. Every allocation is tagged with the
+ * part of tachyon it belongs to so allocations and the bytes held can be
+ * counted per part.
+ */
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum alloc_tag {
+	ALLOC_BUFFER,
+	ALLOC_VT,
+	ALLOC_SCROLLBACK,
+	ALLOC_LOOP,
+	ALLOC_TAG_MAX
+};
+
+struct alloc_counters {
+	uint64_t allocs; /* Calls which allocated, including reallocs */
+	uint64_t frees;
+	uint64_t bytes; /* Bytes currently allocated */
+};
+
+extern struct alloc_counters alloc_counters[ALLOC_TAG_MAX];
+
+void *alloc_malloc(enum alloc_tag tag, size_t size);
+void *alloc_calloc(enum alloc_tag tag, size_t nmemb, size_t size);
+void *alloc_realloc(enum alloc_tag tag, void *ptr, size_t size);
+void alloc_free(enum alloc_tag tag, void *ptr);
+uint64_t alloc_total(void);
+uint64_t alloc_bytes(void);
+void alloc_print(FILE *file);
+
+#endif
@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include "loop.h"
 #include "controller.h"
@@ -33,11 +34,18 @@
 #include "predictor.h"
 #include "options.h"
 #include "vt.h"
+#include "record.h"
+#include "trace.h"
+#include "clock.h"
+#include "alloc.h"
 #include "buffer.h"
 
 static void buffer_cb(struct loop_fd *fd, int revents) {
 	struct buffer *buf = container_of(fd, struct buffer, fd);
+	uint64_t time;
 	int result;
+	int space;
+	int id;
 
 	VLOG("buffer %p %d", buf, revents);
 	if (revents & (POLLHUP | POLLERR)) {
@@ -54,10 +62,18 @@ static void buffer_cb(struct loop_fd *fd, int revents) {
 		if (result < 0) {
 			WLOG("error reading buffer %p %d %d", buf, result, errno);
 		} else {
+			STATS_ADD(buf->stats.bytes_read, result);
+			TRACE(TRACE_PTY_READ, buf->bufid, result);
+			record_event(RECORD_OUTPUT, buf->bufid, result, bytes);
+			space = controller_output_space();
 			result = predictor_learn(&buf->predictor, buf, result, bytes);
 			if (result != 0) {
 				WLOG("controller ran out of space! dropping chars");
 			}
+			/* Background buffers queue nothing, don't claim what others queued */
+			if (controller_output_space() != space)
+				controller_mark_output(buf->bufid, loop_wakeup_time());
+			controller_enforce_memory_budget();
 		}
 	}
 
@@ -68,7 +84,13 @@ static void buffer_cb(struct loop_fd *fd, int revents) {
 		if (result <= 0) {
 			WLOG("error writing buffer %p %d %d", buf, result, errno);
 		} else {
+			STATS_ADD(buf->stats.bytes_written, result);
 			buf->buf_out_used -= result;
+			memmove(buf->buf_out, buf->buf_out + result, buf->buf_out_used);
+
+			histogram_marks_written(&buf->buf_out_marks, result);
+			while (histogram_marks_pop(&buf->buf_out_marks, &id, &time))
+				histogram_record(&buf->stats.input_latency, clock_now_us() - time);
 			if (buf->buf_out_used == 0)
 				buf->fd.poll_flags &= ~POLLOUT;
 		}
@@ -76,17 +98,18 @@ static void buffer_cb(struct loop_fd *fd, int revents) {
 }
 
 /*
- * Initialize a buffer.
+ * Initialize a buffer with no slave, whose output comes from elsewhere such
+ * as a replayed recording.
  *
  * Returns:
  * A struct buffer * on success
  * NULL on failure
  */
-struct buffer *buffer_init(int bufid, int rows, int cols) {
+struct buffer *buffer_init_detached(int bufid, int rows, int cols) {
 	struct buffer *buffer;
 	int result;
 
-	buffer = malloc(sizeof(*buffer));
+	buffer = alloc_malloc(ALLOC_BUFFER, sizeof(*buffer));
 	if (!buffer)
 		return NULL;
 
@@ -97,6 +120,38 @@ struct buffer *buffer_init(int bufid, int rows, int cols) {
 		goto out_free;
 
 	buffer->bufid = bufid;
+	buffer->fd.fd = -1;
+
+	if (vt_init(&buffer->vt, rows, cols))
+		goto out_free_predictor;
+
+	record_resize(bufid, rows, cols);
+
+	return buffer;
+
+out_free_predictor:
+	predictor_free(&buffer->predictor);
+
+out_free:
+	alloc_free(ALLOC_BUFFER, buffer);
+	return NULL;
+}
+
+/*
+ * Initialize a buffer.
+ *
+ * Returns:
+ * A struct buffer * on success
+ * NULL on failure
+ */
+struct buffer *buffer_init(int bufid, int rows, int cols) {
+	struct buffer *buffer;
+	int result;
+
+	buffer = buffer_init_detached(bufid, rows, cols);
+	if (!buffer)
+		return NULL;
+
 	buffer->fd.poll_flags = POLLIN | POLLPRI;
 	buffer->fd.poll_callback = buffer_cb;
 	buffer->fd.fd = tty_new(cmd_options.new_buf_command, bufid);
@@ -104,35 +159,31 @@ struct buffer *buffer_init(int bufid, int rows, int cols) {
 	if (buffer->fd.fd < 0)
 		goto out_free;
 
-	if (vt_init(&buffer->vt, rows, cols))
-		goto out_free_fd;
-
 	result = loop_register(&buffer->fd);
 	if (result != 0)
-		goto out_free_fd;
+		goto out_free;
 
 	return buffer;
 
-out_free_fd:
-	close(buffer->fd.fd);
-
 out_free:
-	free(buffer);
+	buffer_free(buffer);
 	return NULL;
 }
 
 void buffer_free(struct buffer *buffer) {
 	loop_deregister(&buffer->fd);
 	predictor_free(&buffer->predictor);
-	close(buffer->fd.fd);
+	if (buffer->fd.fd >= 0)
+		close(buffer->fd.fd);
 
 	vt_free(&buffer->vt);
 
-	free(buffer);
+	alloc_free(ALLOC_BUFFER, buffer);
 }
 
 int buffer_set_winsize(struct buffer *buf, int rows, int cols) {
 	tty_set_winsize(buf->fd.fd, rows, cols);
+	record_resize(buf->bufid, rows, cols);
 	return 1;
 #if 0
 	if (rows != buf->rows || cols != buf->cols) {
@@ -176,21 +227,27 @@ out:
 int buffer_input(struct buffer *buffer, int size, char *buf) {
 	int result = controller_output(buffer->bufid, size, buf);
 
+	TRACE(TRACE_VT_PARSE_BEGIN, buffer->bufid, size);
 	for (int i = 0; i < size; i++)
 		vt_interpret(buffer, buf[i]);
+	TRACE(TRACE_VT_PARSE_END, buffer->bufid, size);
 
 	return result;
 }
 
 static int _buffer_output(struct buffer *buffer, int size, char *buf) {
-	if (size > sizeof(buffer->buf_out) - buffer->buf_out_used)
+	if (size > sizeof(buffer->buf_out) - buffer->buf_out_used) {
+		STATS_ADD(buffer->stats.bytes_dropped, size);
 		return EAGAIN;
+	}
 
-	memcpy(&buffer->buf_out + buffer->buf_out_used,
-	       buf, size);
+	memcpy(buffer->buf_out + buffer->buf_out_used, buf, size);
 	buffer->buf_out_used += size;
+	histogram_marks_queued(&buffer->buf_out_marks, size);
 	buffer->fd.poll_flags |= POLLOUT;
 
+	record_event(RECORD_INPUT, buffer->bufid, size, buf);
+
 	return 0;
 }
 
@@ -207,64 +264,175 @@ int buffer_output(struct buffer *buffer, int size, char *buf) {
 				_buffer_output);
 }
 
+/*
+ * Move the cursor of the controller to the given cell.
+ *
+ * Returns the number of bytes output.
+ */
+int buffer_goto(struct buffer *buffer, int row, int col) {
+	char buf[16];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "\033[%d;%df", row + 1, col + 1);
+	controller_output(buffer->bufid, len, buf);
+
+	return len;
+}
+
+/*
+ * Output the given cell at the controller cursor position, leaving the
+ * controller with no style set.
+ *
+ * Returns the number of bytes output.
+ */
+int buffer_output_cell(struct buffer *buffer, struct vt_cell *cell) {
+	const char space[] = " ";
+	char buf[16];
+	int len;
+	int total = 1;
+	uint64_t style;
+
+	if (cell && cell->flags & VT_FLAG_CELL_SET) {
+		style = cell->flags & VT_ALL_STYLES;
+
+		for (int i = 0; i < VT_STYLE_MAX; i++) {
+			if (style & (1ULL << i)) {
+				len = snprintf(buf, sizeof(buf), "\033[%dm", i);
+				controller_output(buffer->bufid, len, buf);
+				total += len;
+			}
+		}
+
+		controller_output(buffer->bufid, 1, &cell->c);
+
+		if (style != 0) {
+			controller_output(buffer->bufid, 4, "\033[0m");
+			total += 4;
+		}
+	} else {
+		controller_output(buffer->bufid, 1, space);
+	}
+
+	return total;
+}
+
+/*
+ * Return the controller cursor and style to where the terminal emulation
+ * has them, after something else has been drawn over the buffer.
+ *
+ * Returns the number of bytes output.
+ */
+int buffer_restore_cursor(struct buffer *buffer) {
+	char buf[16];
+	int len;
+	int total;
+	uint64_t style = buffer->vt.current.flags & VT_ALL_STYLES;
+
+	total = buffer_goto(buffer, buffer->vt.current.row, buffer->vt.current.col);
+
+	for (int i = 0; i < VT_STYLE_MAX; i++) {
+		if (style & (1ULL << i)) {
+			len = snprintf(buf, sizeof(buf), "\033[%dm", i);
+			controller_output(buffer->bufid, len, buf);
+			total += len;
+		}
+	}
+
+	return total;
+}
+
 /*
  * Redraw all the buffer contents to its controller
  */
 void buffer_redraw(struct buffer *buffer) {
-	struct vt_cell *cell;
 	const char vt100_goto_origin[] = "\033[f";
-	const char space[] = " ";
 	const char osc_set_window[] = "\033]2;";
 	const char osc_set_icon[] = "\033]1;";
 	const char bell[] = "\007";
-	char buf[16];
+	uint64_t bytes = 0;
 	int len;
-	uint64_t style;
+
+	TRACE(TRACE_REDRAW_BEGIN, buffer->bufid, 0);
 
 	controller_output(buffer->bufid, sizeof(vt100_goto_origin) - 1,
 			  vt100_goto_origin);
 
 	controller_output(buffer->bufid, sizeof(osc_set_window) - 1,
 			  osc_set_window);
-	if (buffer->vt.window_title[0] != '\0')
-		controller_output(buffer->bufid, strlen(buffer->vt.window_title),
-				  buffer->vt.window_title);
+	len = strlen(buffer->vt.window_title);
+	if (len > 0)
+		controller_output(buffer->bufid, len, buffer->vt.window_title);
 	controller_output(buffer->bufid, sizeof(bell) - 1, bell);
+	bytes += sizeof(vt100_goto_origin) + sizeof(osc_set_window) + sizeof(bell) - 3 + len;
 
 	controller_output(buffer->bufid, sizeof(osc_set_icon) - 1,
 			  osc_set_icon);
-	if (buffer->vt.icon_name[0] != '\0')
-		controller_output(buffer->bufid, strlen(buffer->vt.icon_name),
-				  buffer->vt.icon_name);
+	len = strlen(buffer->vt.icon_name);
+	if (len > 0)
+		controller_output(buffer->bufid, len, buffer->vt.icon_name);
 	controller_output(buffer->bufid, sizeof(bell) - 1, bell);
+	bytes += sizeof(osc_set_icon) + sizeof(bell) - 2 + len;
 
 	for (int row = 0; row < buffer->vt.rows; row++) {
-		for (int col = 0; col < buffer->vt.cols; col++) {
-			cell = vt_get_cell(buffer, row, col);
-			if (cell->flags & VT_FLAG_CELL_SET) {
-				style = cell->flags & VT_ALL_STYLES;
-
-				for (int i = 0; i < VT_STYLE_MAX; i++) {
-					if (style & (1ULL << i)) {
-						len = snprintf(buf, sizeof(buf), "\033[%dm", i);
-						controller_output(buffer->bufid, len, buf);
-					}
-				}
-
-				controller_output(buffer->bufid, 1, &cell->c);
-
-				if (style != 0)
-					controller_output(buffer->bufid, 4, "\033[0m");
-			} else {
-				controller_output(buffer->bufid, 1, space);
-			}
-		}
-		if (row < buffer->vt.rows - 1)
+		for (int col = 0; col < buffer->vt.cols; col++)
+			bytes += buffer_output_cell(buffer, vt_get_cell(buffer, row, col));
+
+		if (row < buffer->vt.rows - 1) {
 			controller_output(buffer->bufid, 2, "\r\n");
+			bytes += 2;
+		}
 	}
 
-	len = snprintf(buf, sizeof(buf), "\033[%d;%df", buffer->vt.current.row + 1,
-		       buffer->vt.current.col + 1);
-	controller_output(buffer->bufid, len, buf);
+	bytes += buffer_goto(buffer, buffer->vt.current.row, buffer->vt.current.col);
 
+	STATS_INC(buffer->stats.redraws);
+	STATS_ADD(buffer->stats.redraw_bytes, bytes);
+	TRACE(TRACE_REDRAW_END, buffer->bufid, bytes);
+}
+
+/*
+ * Work out the bytes held by the buffer. This is computed from the sizes
+ * of its parts rather than tracked so it costs nothing until asked for.
+ */
+void buffer_memory(struct buffer *buffer, struct buffer_memory *memory) {
+	struct vt *vt = &buffer->vt;
+	size_t line = vt_line_bytes(vt);
+	size_t history = 0;
+
+	if (vt->scrollback.len > vt->rows)
+		history = vt->scrollback.len - vt->rows;
+
+	/* Both screens and the arrays of pointers to their lines */
+	memory->viewport = 2 * vt->rows * (line + sizeof(*vt->lines));
+	memory->scrollback = history * line + scrollback_bytes(&vt->scrollback);
+	memory->io = sizeof(buffer->buf_out) + sizeof(buffer->buf_out_marks);
+	memory->predictor = sizeof(buffer->predictor);
+	memory->other = sizeof(*buffer) - memory->io - memory->predictor;
+
+	memory->total = memory->viewport + memory->scrollback + memory->io +
+			memory->predictor + memory->other;
+}
+
+/*
+ * Print the counters of the buffer and its predictor in a human readable
+ * form.
+ */
+void buffer_print_stats(struct buffer *buffer, FILE *file) {
+	struct buffer_stats *stats = &buffer->stats;
+	struct predictor_stats *predictor = &buffer->predictor.stats;
+
+	fprintf(file, "buffer %d\n", buffer->bufid);
+	fprintf(file, "  bytes read        %" PRIu64 "\n", stats->bytes_read);
+	fprintf(file, "  bytes written     %" PRIu64 "\n", stats->bytes_written);
+	fprintf(file, "  bytes dropped     %" PRIu64 "\n", stats->bytes_dropped);
+	fprintf(file, "  redraws           %" PRIu64 " (%" PRIu64 " bytes)\n", stats->redraws,
+		stats->redraw_bytes);
+	fprintf(file, "  scrolls           %" PRIu64 "\n", stats->scrolls);
+	fprintf(file, "  lines allocated   %" PRIu64 "\n", stats->lines_allocated);
+	fprintf(file, "  lines evicted     %" PRIu64 "\n", stats->lines_evicted);
+	fprintf(file, "  keys predicted    %lu of %lu\n", predictor->predicted, predictor->keys);
+	fprintf(file, "  cells confirmed   %lu\n", predictor->confirmed);
+	fprintf(file, "  cells mispredicted %lu\n", predictor->mispredicted);
+	histogram_print(&stats->output_latency, "  output latency   ", file);
+	histogram_print(&stats->input_latency, "  input latency    ", file);
 }
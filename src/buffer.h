@@ -21,11 +21,13 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "loop.h"
 #include "predictor.h"
 #include "vt.h"
+#include "stats.h"
 
 #define BUFFER_BUF_SIZE 1024
 
@@ -37,15 +39,36 @@ struct buffer {
 
 	int buf_out_used;
 	char buf_out[BUFFER_BUF_SIZE];
+	struct histogram_marks buf_out_marks;
 
 	struct vt vt;
+
+	struct buffer_stats stats;
+};
+
+/*
+ * Bytes held by a buffer, by what holds them.
+ */
+struct buffer_memory {
+	size_t viewport; /* Lines of the primary and alternate screens */
+	size_t scrollback; /* Lines above the screen and the scroll buffer holding them */
+	size_t io; /* Queue of input to the slave */
+	size_t predictor;
+	size_t other; /* The rest of struct buffer, mostly the emulation state and stats */
+	size_t total;
 };
 
 struct buffer *buffer_init(int bufid, int rows, int cols);
+struct buffer *buffer_init_detached(int bufid, int rows, int cols);
 void buffer_free(struct buffer *buffer);
 int buffer_set_winsize(struct buffer *buf, int rows, int cols);
 int buffer_output(struct buffer *buffer, int size, char *buf);
 int buffer_input(struct buffer *buffer, int size, char *buf);
 void buffer_redraw(struct buffer *buffer);
+int buffer_goto(struct buffer *buffer, int row, int col);
+int buffer_output_cell(struct buffer *buffer, struct vt_cell *cell);
+int buffer_restore_cursor(struct buffer *buffer);
+void buffer_print_stats(struct buffer *buffer, FILE *file);
+void buffer_memory(struct buffer *buffer, struct buffer_memory *memory);
 
 #endif
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * The monotonic clock. This is kept in its own file so tools which need to
+ * control time, such as replaying recorded sessions, can substitute their
+ * own clock.
+ */
+
+#include <time.h>
+
+#include "clock.h"
+
+/*
+ * Returns the current time in microseconds from an arbitrary starting
+ * point. This time never goes backwards.
+ */
+uint64_t clock_now_us(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -48,4 +48,23 @@
  */
 #define VT_PARAM_LEN 128
 
+/*
+ * Most verbose log level compiled in, 3 for everything down to VLOG. Release
+ * builds lower it so the verbose logging in hot paths vanishes.
+ */
+#ifndef LOG_MAX_VERBOSITY
+#define LOG_MAX_VERBOSITY 3
+#endif
+
+/*
+ * Size of the ring holding log messages until the loop is idle enough to
+ * write them to the log file. Must be a power of two.
+ */
+#define LOG_RING_SIZE (64 * 1024)
+
+/*
+ * Longest log message, longer messages are truncated.
+ */
+#define LOG_LINE_LEN 512
+
 #endif
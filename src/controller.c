@@ -21,9 +21,11 @@
 
 #include <poll.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <sys/signal.h>
 #include <termios.h>
 #include <sys/ioctl.h>
@@ -35,6 +37,10 @@
 #include "tty.h"
 #include "options.h"
 #include "config.h"
+#include "stats.h"
+#include "trace.h"
+#include "clock.h"
+#include "alloc.h"
 #include "controller.h"
 
 #define STDIN 0
@@ -93,6 +99,18 @@ static void bufstack_swap(int leaving, int entering) {
 	buffer_stack[0] = leaving;
 }
 
+/*
+ * Returns whether the given buffer is on the buffer stack.
+ */
+static bool bufstack_contains(int bufnum) {
+	for (int i = 0; i < ARRAY_SIZE(buffer_stack); i++) {
+		if (buffer_stack[i] == bufnum)
+			return true;
+	}
+
+	return false;
+}
+
 /*
  * Remove the given buffer from the buffer stack. Usually because that
  * buffer has closed.
@@ -104,12 +122,12 @@ static void bufstack_remove(int bufnum) {
 	while (i < ARRAY_SIZE(buffer_stack) && buffer_stack[i] != bufnum)
 		i++;
 
-	if (i == CONTROLLER_MAX_BUFS) {
+	if (i == size) {
 		ELOG("Failed to find bufnum %d to remove", bufnum);
 		return;
 	}
 
-	memmove(&buffer_stack[i], &buffer_stack[i + 1], (size - i) * sizeof(*buffer_stack));
+	memmove(&buffer_stack[i], &buffer_stack[i + 1], (size - i - 1) * sizeof(*buffer_stack));
 	buffer_stack[size - 1] = -1;
 }
 
@@ -143,13 +161,16 @@ static void controller_clear(int bufid) {
  */
 static void controller_set_current_buffer(unsigned int num) {
 	if (GCon.buffers[num] != NULL) {
-		bufstack_swap(current_buf_num, num);
+		/* Redrawing the current buffer mustn't put it on the stack */
+		if (num != current_buf_num)
+			bufstack_swap(current_buf_num, num);
 		current_buf_num = num;
 		current_buf = GCon.buffers[num];
 	}
 
 	controller_clear(current_buf_num);
 	buffer_redraw(current_buf);
+	predictor_redraw(&current_buf->predictor, current_buf);
 }
 
 /*
@@ -249,6 +270,175 @@ static void controller_goto_buffer(int bufnum) {
 		controller_set_current_buffer(bufnum);
 }
 
+/*
+ * Print the global counters and those of every buffer.
+ */
+static void controller_print_stats(FILE *file) {
+	stats_print(file);
+
+	for (int i = 0; i < CONTROLLER_MAX_BUFS; i++)
+		if (GCon.buffers[i])
+			buffer_print_stats(GCon.buffers[i], file);
+}
+
+/*
+ * Free the oldest scrollback of the least recently viewed buffers until the
+ * session allocates no more than its memory budget. Buffers which were never
+ * viewed go first and the current buffer goes last.
+ */
+void controller_enforce_memory_budget(void) {
+	uint64_t budget = (uint64_t)cmd_options.memory_budget * 1024;
+	int order[CONTROLLER_MAX_BUFS];
+	int num = 0;
+	int i;
+
+	if (budget == 0 || alloc_bytes() <= budget)
+		return;
+
+	for (i = 0; i < CONTROLLER_MAX_BUFS; i++) {
+		if (GCon.buffers[i] && i != current_buf_num && !bufstack_contains(i))
+			order[num++] = i;
+	}
+
+	/* The bottom of the buffer stack was viewed longest ago */
+	for (i = ARRAY_SIZE(buffer_stack) - 1; i >= 0; i--) {
+		if (buffer_stack[i] != -1 && GCon.buffers[buffer_stack[i]])
+			order[num++] = buffer_stack[i];
+	}
+
+	if (current_buf)
+		order[num++] = current_buf_num;
+
+	for (i = 0; i < num; i++) {
+		struct buffer *buffer = GCon.buffers[order[i]];
+		size_t line = vt_line_bytes(&buffer->vt);
+		uint64_t total;
+
+		while ((total = alloc_bytes()) > budget) {
+			if (!vt_evict_scrollback(buffer, (total - budget + line - 1) / line))
+				break;
+		}
+
+		if (total <= budget)
+			return;
+	}
+
+	VLOG("Session is over its memory budget with no scrollback left to free");
+}
+
+/*
+ * Print the memory held by the session and by each buffer, the buffers
+ * holding the most first.
+ */
+static void controller_print_memory(FILE *file) {
+	struct buffer_memory memory[CONTROLLER_MAX_BUFS];
+	int order[CONTROLLER_MAX_BUFS];
+	size_t total = 0;
+	int num = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < CONTROLLER_MAX_BUFS; i++) {
+		if (!GCon.buffers[i])
+			continue;
+
+		buffer_memory(GCon.buffers[i], &memory[i]);
+		total += memory[i].total;
+
+		/* Insert in order of decreasing total */
+		for (j = num; j > 0 && memory[order[j - 1]].total < memory[i].total; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+		num++;
+	}
+
+	fprintf(file, "session %zu KiB in buffers, %" PRIu64 " KiB allocated in total\n",
+		total / 1024, alloc_bytes() / 1024);
+	fprintf(file, "buffer %10s %10s %10s %10s %10s %10s KiB\n", "total", "viewport",
+		"scrollback", "io", "predictor", "other");
+
+	for (i = 0; i < num; i++) {
+		struct buffer_memory *m = &memory[order[i]];
+
+		fprintf(file, "%6d %10zu %10zu %10zu %10zu %10zu %10zu\n", order[i],
+			m->total / 1024, m->viewport / 1024, m->scrollback / 1024, m->io / 1024,
+			m->predictor / 1024, m->other / 1024);
+	}
+}
+
+/*
+ * Draw what the given function prints over the current buffer until the
+ * next key is pressed. Lines are cut at the edge of the terminal and when
+ * there are more lines than rows the last row says so.
+ */
+static void controller_show_overlay(void (*print)(FILE *file)) {
+	const char more[] = "...";
+	char *text = NULL;
+	size_t size = 0;
+	char *line;
+	char *next;
+	int row = 0;
+	FILE *file;
+
+	file = open_memstream(&text, &size);
+	if (!file) {
+		WLOG("Unable to format overlay %d", errno);
+		return;
+	}
+	print(file);
+	fclose(file);
+
+	controller_clear(current_buf_num);
+	controller_output(current_buf_num, 3, "\033[f");
+	for (line = text; (next = strchr(line, '\n')); line = next + 1, row++) {
+		if (row > 0)
+			controller_output(current_buf_num, 2, "\r\n");
+
+		if (row == terminal_rows - 1 && strchr(next + 1, '\n')) {
+			controller_output(current_buf_num, sizeof(more) - 1, more);
+			break;
+		}
+
+		controller_output(current_buf_num, min(next - line, terminal_cols), line);
+	}
+	free(text);
+
+	GCon.flags |= CONTROLLER_SHOWING_OVERLAY;
+}
+
+/*
+ * Dump the counters and memory use to the stats file so they can be read
+ * without disturbing the display.
+ */
+static void handle_sigusr1(siginfo_t *siginfo, int num_signals) {
+	FILE *file;
+	int fd;
+
+	if (cmd_options.stats_path[0] == '\0') {
+		WLOG("Nowhere to dump stats, give a file with --stats");
+		return;
+	}
+
+	/* Never follow a link planted in place of the file */
+	fd = open(cmd_options.stats_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+	if (fd < 0) {
+		WLOG("Unable to dump stats to '%s' %d", cmd_options.stats_path, errno);
+		return;
+	}
+
+	file = fdopen(fd, "w");
+	if (!file) {
+		WLOG("Unable to dump stats to '%s' %d", cmd_options.stats_path, errno);
+		close(fd);
+		return;
+	}
+
+	controller_print_stats(file);
+	controller_print_memory(file);
+	fclose(file);
+	DLOG("Dumped stats to '%s'", cmd_options.stats_path);
+}
+
 static int controller_handle_metakey(int size, char *input) {
 	int bytes_eaten = 0;
 	int meta_start = 0;
@@ -296,6 +486,12 @@ static int controller_handle_metakey(int size, char *input) {
 			} else if (input[i] == cmd_options.keys.buffer_last) {
 				VLOG("Changing to last buffer");
 				controller_last_buffer();
+			} else if (input[i] == cmd_options.keys.stats) {
+				VLOG("Showing stats");
+				controller_show_overlay(controller_print_stats);
+			} else if (input[i] == cmd_options.keys.memory) {
+				VLOG("Showing memory");
+				controller_show_overlay(controller_print_memory);
 			} else if (input[i] == cmd_options.keys.buffer_0) {
 				VLOG("Changing to buffer 0");
 				controller_goto_buffer(0);
@@ -360,11 +556,24 @@ static void controller_cb_in(struct loop_fd *fd, int revents) {
 		if (result < 0) {
 			WLOG("error reading controller %p %d %d", controller, result, errno);
 		} else {
+			STATS_ADD(GStats.controller_bytes_read, result);
+
+			/* Any key dismisses an overlay */
+			if (controller->flags & CONTROLLER_SHOWING_OVERLAY) {
+				controller->flags &= ~CONTROLLER_SHOWING_OVERLAY;
+				controller_set_current_buffer(current_buf_num);
+				return;
+			}
+
 			result = controller_handle_metakey(result, bytes);
 			if (result > 0) {
 				result = buffer_output(current_buf, result, bytes);
 				if (result != 0) {
 					WLOG("buffer ran out of space! dropping chars");
+				} else {
+					/* Only the keys just queued arrived now */
+					histogram_marks_mark(&current_buf->buf_out_marks,
+							     current_buf_num, loop_wakeup_time());
 				}
 			}
 		}
@@ -373,7 +582,9 @@ static void controller_cb_in(struct loop_fd *fd, int revents) {
 
 static void controller_cb_out(struct loop_fd *fd, int revents) {
 	struct controller *controller = container_of(fd, struct controller, out);
+	uint64_t time;
 	int result;
+	int bufid;
 
 	VLOG("controller %p out %d", controller, revents);
 	if (revents & (POLLHUP | POLLERR)) {
@@ -384,7 +595,9 @@ static void controller_cb_out(struct loop_fd *fd, int revents) {
 
 	if (revents & POLLOUT) {
 		/* flush data to pty */
+		TRACE(TRACE_FLUSH_BEGIN, current_buf_num, controller->buf_out_used);
 		result = write(controller->out.fd, controller->buf_out, controller->buf_out_used);
+		TRACE(TRACE_FLUSH_END, current_buf_num, result);
 		VLOG("wrote %d bytes to controller %p", result, controller);
 		if (result < 0) {
 			WLOG("error writing controller %p %d %d", controller, result, errno);
@@ -392,7 +605,16 @@ static void controller_cb_out(struct loop_fd *fd, int revents) {
 			/* The out fd closed */
 			exit(0);
 		} else {
+			STATS_ADD(GStats.controller_bytes_written, result);
 			controller->buf_out_used -= result;
+			memmove(controller->buf_out, controller->buf_out + result,
+				controller->buf_out_used);
+
+			histogram_marks_written(&controller->buf_out_marks, result);
+			while (histogram_marks_pop(&controller->buf_out_marks, &bufid, &time))
+				if (GCon.buffers[bufid])
+					histogram_record(&GCon.buffers[bufid]->stats.output_latency,
+							 clock_now_us() - time);
 			if (controller->buf_out_used == 0)
 				controller->out.poll_flags &= ~POLLOUT;
 		}
@@ -444,6 +666,7 @@ int controller_init(void) {
 		buffer_stack[i] = -1;
 
 	loop_register_signal(SIGWINCH, handle_sigwinch);
+	loop_register_signal(SIGUSR1, handle_sigusr1);
 
 	/* Force the window size of the slave */
 	handle_sigwinch(NULL, -1);
@@ -455,6 +678,66 @@ out_deregister:
 	return result;
 }
 
+/*
+ * Initialize the global controller to replay a recording to the given fd.
+ * There is no input and the buffers are created as the recording refers to
+ * them with controller_replay_buffer().
+ *
+ * Returns:
+ * 0      - On success
+ * ENOMEM - Failed to allocate memory to register
+ */
+int controller_init_replay(int out_fd) {
+	GCon.in.fd = -1;
+
+	GCon.out.fd = out_fd;
+	GCon.out.poll_flags = 0;
+	GCon.out.poll_callback = controller_cb_out;
+
+	GCon.buf_out_used = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(buffer_stack); i++)
+		buffer_stack[i] = -1;
+
+	return loop_register((struct loop_fd *)&GCon.out);
+}
+
+/*
+ * Find the replay buffer with the given id, creating it with the given size
+ * if it doesn't exist yet. The first buffer created is the one displayed.
+ *
+ * Returns:
+ * A struct buffer * on success
+ * NULL on failure
+ */
+struct buffer *controller_replay_buffer(int bufid, int rows, int cols) {
+	if (bufid < 0 || bufid >= CONTROLLER_MAX_BUFS)
+		return NULL;
+
+	if (GCon.buffers[bufid])
+		return GCon.buffers[bufid];
+
+	GCon.buffers[bufid] = buffer_init_detached(bufid, rows, cols);
+	if (!GCon.buffers[bufid])
+		return NULL;
+
+	if (!current_buf) {
+		current_buf_num = bufid;
+		current_buf = GCon.buffers[bufid];
+		controller_clear(bufid);
+	}
+
+	return GCon.buffers[bufid];
+}
+
+/*
+ * Returns the number of bytes which can be output to the controller before
+ * it runs out of space.
+ */
+int controller_output_space(void) {
+	return sizeof(GCon.buf_out) - GCon.buf_out_used;
+}
+
 /*
  * Queue data to be output to stdout so the user can see it. Either all the
  * bytes or none of the bytes will be queued.
@@ -464,8 +747,10 @@ out_deregister:
  * EAGAIN - The buffer is currently full
  */
 int controller_output(int bufid, int size, const char *buf) {
-	if (size > sizeof(GCon.buf_out) - GCon.buf_out_used)
+	if (size > sizeof(GCon.buf_out) - GCon.buf_out_used) {
+		STATS_ADD(GStats.controller_bytes_dropped, size);
 		return EAGAIN;
+	}
 
 	/* If this isn't for the current buffer don't output it */
 	if (bufid != current_buf_num)
@@ -474,11 +759,21 @@ int controller_output(int bufid, int size, const char *buf) {
 	memcpy(GCon.buf_out + GCon.buf_out_used,
 	       buf, size);
 	GCon.buf_out_used += size;
+	histogram_marks_queued(&GCon.buf_out_marks, size);
 	GCon.out.poll_flags |= POLLOUT;
 
 	return 0;
 }
 
+/*
+ * Mark everything output to the controller so far as coming from the given
+ * buffer at the given time, so the time until it is written to stdout is
+ * recorded in the buffer's output latency.
+ */
+void controller_mark_output(int bufid, uint64_t time) {
+	histogram_marks_mark(&GCon.buf_out_marks, bufid, time);
+}
+
 /*
  * Tell the controller that the given buffer is exiting, usually because the underlying shell has terminated.
  *
@@ -31,9 +31,11 @@ struct controller {
 
 	int flags;
 #define CONTROLLER_IN_META (1 << 0) /* Input processing is in the middle of processing meta keys */
+#define CONTROLLER_SHOWING_OVERLAY (1 << 1) /* Stats or memory use are drawn over the current buffer */
 
 	int buf_out_used;
 	char buf_out[CONTROLLER_BUF_SIZE];
+	struct histogram_marks buf_out_marks;
 
 	struct buffer *buffers[CONTROLLER_MAX_BUFS];
 };
@@ -41,7 +43,12 @@ struct controller {
 bool run;
 
 int controller_init(void);
+int controller_init_replay(int out_fd);
+struct buffer *controller_replay_buffer(int bufid, int rows, int cols);
+int controller_output_space(void);
 int controller_output(int bufid, int size, const char *buf);
+void controller_mark_output(int bufid, uint64_t time);
+void controller_enforce_memory_budget(void);
 void controller_buffer_exiting(int bufid);
 
 #endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Latency histograms and the marks used to measure latencies through byte
+ * streams.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "util.h"
+#include "histogram.h"
+
+static int histogram_msb(uint64_t value) {
+	return 63 - __builtin_clzll(value);
+}
+
+static int histogram_index(uint64_t value) {
+	int msb;
+	int shift;
+
+	if (value < HISTOGRAM_SUB_BUCKETS)
+		return value;
+
+	if (value > UINT32_MAX)
+		value = UINT32_MAX;
+
+	msb = histogram_msb(value);
+	shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+/*
+ * Returns the middle of the range of values held in the given bucket.
+ */
+static uint64_t histogram_value(int index) {
+	int shift;
+	uint64_t low;
+
+	if (index < HISTOGRAM_SUB_BUCKETS)
+		return index;
+
+	shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+	low = (uint64_t)(HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS) << shift;
+
+	return low + ((1ULL << shift) >> 1);
+}
+
+void histogram_record(struct histogram *histogram, uint64_t value) {
+	histogram->buckets[histogram_index(value)]++;
+	histogram->count++;
+	histogram->sum += value;
+	if (value > histogram->max)
+		histogram->max = value;
+}
+
+/*
+ * Returns the value below which the given fraction, from 0 to 1, of the
+ * recorded values lie, or 0 if nothing has been recorded.
+ */
+uint64_t histogram_percentile(struct histogram *histogram, double percentile) {
+	uint64_t target;
+	uint64_t seen = 0;
+
+	if (histogram->count == 0)
+		return 0;
+
+	target = percentile * histogram->count + 0.5;
+	if (target < 1)
+		target = 1;
+
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= target)
+			return min(histogram_value(i), histogram->max);
+	}
+
+	return histogram->max;
+}
+
+/*
+ * Print a one line summary of the histogram, in microseconds.
+ */
+void histogram_print(struct histogram *histogram, const char *name, FILE *file) {
+	fprintf(file, "%s n %" PRIu64 " mean %" PRIu64 " p50 %" PRIu64 " p99 %" PRIu64
+		" p99.9 %" PRIu64 " max %" PRIu64 " us\n", name, histogram->count,
+		histogram->count ? histogram->sum / histogram->count : 0,
+		histogram_percentile(histogram, 0.5), histogram_percentile(histogram, 0.99),
+		histogram_percentile(histogram, 0.999), histogram->max);
+}
+
+/*
+ * Account for bytes added to the stream.
+ */
+void histogram_marks_queued(struct histogram_marks *marks, int bytes) {
+	marks->queued += bytes;
+}
+
+/*
+ * Mark the bytes queued so far as having arrived at the given time. Bytes
+ * already covered by an earlier mark keep it. If there are too many marks
+ * outstanding this one is skipped.
+ */
+void histogram_marks_mark(struct histogram_marks *marks, int id, uint64_t time) {
+	int tail;
+
+	if (marks->used > 0 &&
+	    marks->marks[(marks->head + marks->used - 1) % HISTOGRAM_MARKS].end == marks->queued)
+		return;
+
+	if (marks->queued == marks->written || marks->used == HISTOGRAM_MARKS)
+		return;
+
+	tail = (marks->head + marks->used) % HISTOGRAM_MARKS;
+	marks->marks[tail].end = marks->queued;
+	marks->marks[tail].time = time;
+	marks->marks[tail].id = id;
+	marks->used++;
+}
+
+/*
+ * Account for bytes leaving the stream.
+ */
+void histogram_marks_written(struct histogram_marks *marks, int bytes) {
+	marks->written += bytes;
+}
+
+/*
+ * Remove the oldest mark if all its bytes have been written.
+ *
+ * Returns true and fills in the id and time of the mark if one was removed.
+ */
+bool histogram_marks_pop(struct histogram_marks *marks, int *id, uint64_t *time) {
+	if (marks->used == 0 || marks->marks[marks->head].end > marks->written)
+		return false;
+
+	*id = marks->marks[marks->head].id;
+	*time = marks->marks[marks->head].time;
+	marks->head = (marks->head + 1) % HISTOGRAM_MARKS;
+	marks->used--;
+
+	return true;
+}
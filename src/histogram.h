@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Header for latency histograms. Buckets are log-linear like an HDR
+ * histogram: each power of two is split into HISTOGRAM_SUB_BUCKETS linear
+ * buckets, so any value is kept to within 1/HISTOGRAM_SUB_BUCKETS of itself
+ * in a fixed, small amount of memory.
+ */
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+
+/* Enough buckets for any 32 bit value */
+#define HISTOGRAM_BUCKETS ((32 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint32_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/*
+ * Most marks outstanding in a stream at once.
+ */
+#define HISTOGRAM_MARKS 64
+
+/*
+ * Tracks when bytes entered a byte stream so the latency until they leave
+ * it can be recorded. Marks are placed at the end of the bytes queued so
+ * far and are popped once every byte before them has been written.
+ */
+struct histogram_marks {
+	uint64_t queued; /* Total bytes ever queued */
+	uint64_t written; /* Total bytes ever written */
+
+	int head;
+	int used;
+	struct {
+		uint64_t end;
+		uint64_t time;
+		int id;
+	} marks[HISTOGRAM_MARKS];
+};
+
+void histogram_record(struct histogram *histogram, uint64_t value);
+uint64_t histogram_percentile(struct histogram *histogram, double percentile);
+void histogram_print(struct histogram *histogram, const char *name, FILE *file);
+
+void histogram_marks_queued(struct histogram_marks *marks, int bytes);
+void histogram_marks_mark(struct histogram_marks *marks, int id, uint64_t time);
+void histogram_marks_written(struct histogram_marks *marks, int bytes);
+bool histogram_marks_pop(struct histogram_marks *marks, int *id, uint64_t *time);
+
+#endif
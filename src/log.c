@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Logging. Until a log file is opened messages go straight to stderr. After,
+ * messages are formatted into a ring and only written out by log_flush()
+ * when the loop is about to wait, keeping file writes off the hot paths.
+ * The ring has a single producer and consumer so needs no lock. Errors
+ * bypass the ring so they are never lost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "log.h"
+
+static int log_fd = -1;
+
+static char ring[LOG_RING_SIZE];
+
+/* Total bytes ever added to and written from the ring */
+static uint32_t ring_head;
+static uint32_t ring_tail;
+
+/* Messages which didn't fit in the ring since the last flush */
+static unsigned long dropped;
+
+static void log_write(const char *buf, size_t len) {
+	ssize_t result;
+
+	while (len > 0) {
+		result = write(log_fd, buf, len);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return;
+
+		buf += result;
+		len -= result;
+	}
+}
+
+/*
+ * Log a message, to the ring if there is a log file and stderr otherwise.
+ */
+void log_printf(const char *fmt, ...) {
+	char line[LOG_LINE_LEN];
+	uint32_t head;
+	uint32_t start;
+	int len;
+	va_list args;
+
+	va_start(args, fmt);
+	if (log_fd < 0) {
+		vfprintf(stderr, fmt, args);
+		va_end(args);
+		return;
+	}
+	len = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	if (len < 0)
+		return;
+	if (len >= sizeof(line))
+		len = sizeof(line) - 1;
+
+	head = ring_head;
+	if (len > LOG_RING_SIZE - (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE))) {
+		dropped++;
+		return;
+	}
+
+	start = head & (LOG_RING_SIZE - 1);
+	if (start + len <= LOG_RING_SIZE) {
+		memcpy(ring + start, line, len);
+	} else {
+		memcpy(ring + start, line, LOG_RING_SIZE - start);
+		memcpy(ring, line + LOG_RING_SIZE - start, len - (LOG_RING_SIZE - start));
+	}
+
+	__atomic_store_n(&ring_head, head + len, __ATOMIC_RELEASE);
+}
+
+/*
+ * Write everything in the ring to the log file.
+ */
+void log_flush(void) {
+	uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+	uint32_t tail = ring_tail;
+	uint32_t start;
+	uint32_t len;
+	char line[64];
+
+	if (log_fd < 0)
+		return;
+
+	while (tail != head) {
+		start = tail & (LOG_RING_SIZE - 1);
+		len = head - tail;
+		if (start + len > LOG_RING_SIZE)
+			len = LOG_RING_SIZE - start;
+
+		log_write(ring + start, len);
+		tail += len;
+	}
+	__atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+
+	if (dropped) {
+		len = snprintf(line, sizeof(line), "%lu log messages dropped\n", dropped);
+		log_write(line, len);
+		dropped = 0;
+	}
+}
+
+/*
+ * Log a message immediately, after anything already waiting in the ring.
+ */
+void log_printf_sync(const char *fmt, ...) {
+	char line[LOG_LINE_LEN];
+	int len;
+	va_list args;
+
+	va_start(args, fmt);
+	if (log_fd < 0) {
+		vfprintf(stderr, fmt, args);
+		va_end(args);
+		return;
+	}
+	len = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	if (len < 0)
+		return;
+	if (len >= sizeof(line))
+		len = sizeof(line) - 1;
+
+	log_flush();
+	log_write(line, len);
+}
+
+/*
+ * Send all further logging to the given file, appending to it.
+ *
+ * Returns:
+ * 0 - On success
+ * Any errno from open()
+ */
+int log_open(const char *path) {
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return errno;
+
+	log_fd = fd;
+	atexit(log_flush);
+
+	return 0;
+}
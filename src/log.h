@@ -19,39 +19,46 @@
 
 #include <stdio.h>
 
+#include "config.h"
 #include "options.h"
 
+void log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_printf_sync(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_flush(void);
+int log_open(const char *path);
+
+/*
+ * Log at the given verbosity. Levels above LOG_MAX_VERBOSITY are compiled
+ * out entirely.
+ */
+#define LOG(level, fmt, ...) do {                                      \
+	if (LOG_MAX_VERBOSITY >= (level) && cmd_options.verbose >= (level)) \
+		log_printf(fmt "\n", ##__VA_ARGS__);                  \
+} while (0)
+
 /*
  * Verbose log, logging that won't be useful to anybody but developers.
  */
-#define VLOG(fmt, ...) do {                               \
-	if (cmd_options.verbose >= 3)                     \
-		fprintf(stderr, fmt "\n", ##__VA_ARGS__); \
-} while(0)
+#define VLOG(fmt, ...) LOG(3, fmt, ##__VA_ARGS__)
 
 /*
  * Debug log, logging which might be useful to people trying to figure out why something doesn't
  * work.
  */
-#define DLOG(fmt, ...) do {                               \
-	if (cmd_options.verbose >= 2)                     \
-		fprintf(stderr, fmt "\n", ##__VA_ARGS__); \
-} while (0)
+#define DLOG(fmt, ...) LOG(2, fmt, ##__VA_ARGS__)
 
 /*
  * Warn log, logging something the user should know about which isn't normal.
  */
-#define WLOG(fmt, ...) do {                               \
-	if (cmd_options.verbose >= 1)                     \
-		fprintf(stderr, fmt "\n", ##__VA_ARGS__); \
-} while (0)
+#define WLOG(fmt, ...) LOG(1, fmt, ##__VA_ARGS__)
 
 /*
  * Error log, logging the user must know about because something is broken.
+ * Written immediately since tachyon may be about to die.
  */
-#define ELOG(fmt, ...) do {                               \
-	if (cmd_options.verbose >= 0)                     \
-		fprintf(stderr, fmt "\n", ##__VA_ARGS__); \
+#define ELOG(fmt, ...) do {                                    \
+	if (cmd_options.verbose >= 0)                          \
+		log_printf_sync(fmt "\n", ##__VA_ARGS__);     \
 } while (0)
 
 /*
@@ -30,6 +30,11 @@
 #include "log.h"
 #include "pal.h"
 #include "util.h"
+#include "clock.h"
+#include "alloc.h"
+#include "stats.h"
+#include "trace.h"
+#include "record.h"
 
 #include "loop.h"
 
@@ -48,6 +53,13 @@ static int num_loop_items;
 /* The number of item allocated, which may be less than num_loop_items */
 static int max_loop_items;
 
+/* When the last poll returned */
+static uint64_t wakeup_time;
+
+static struct loop_timer **timers;
+static int num_timers;
+static int max_timers;
+
 static struct signal_fd {
 	struct loop_fd fd;
 
@@ -76,14 +88,14 @@ int loop_register(struct loop_fd *fd) {
 		else
 			new_size = 2 * max_loop_items;
 
-		new_items = calloc(new_size, sizeof(*loop_items));
-		new_fds = calloc(new_size, sizeof(*loop_items));
+		new_items = alloc_calloc(ALLOC_LOOP, new_size, sizeof(*new_items));
+		new_fds = alloc_calloc(ALLOC_LOOP, new_size, sizeof(*new_fds));
 
 		if (!new_items || !new_fds) {
 			if (new_items)
-				free(new_items);
+				alloc_free(ALLOC_LOOP, new_items);
 			if (new_fds)
-				free(new_fds);
+				alloc_free(ALLOC_LOOP, new_fds);
 
 			return ENOMEM;
 		}
@@ -91,9 +103,9 @@ int loop_register(struct loop_fd *fd) {
 		memmove(new_items, loop_items, max_loop_items * sizeof(*loop_items));
 		memmove(new_fds, fds, max_loop_items * sizeof(*fds));
 
-		free(loop_items);
+		alloc_free(ALLOC_LOOP, loop_items);
 		loop_items = new_items;
-		free(fds);
+		alloc_free(ALLOC_LOOP, fds);
 		fds = new_fds;
 
 		max_loop_items = new_size;
@@ -120,6 +132,9 @@ int loop_deregister(struct loop_fd *fd) {
 		if (loop_items[i].fd == fd)
 			break;
 
+	if (i == num_loop_items)
+		return 0;
+
 	memmove(&loop_items[i], &loop_items[num_loop_items - 1], sizeof(*loop_items));
 	memmove(&fds[i], &fds[num_loop_items - 1], sizeof(*fds));
 
@@ -128,6 +143,96 @@ int loop_deregister(struct loop_fd *fd) {
 	return 0;
 }
 
+/*
+ * Register a loop_timer to be fired once its deadline passes. The timer
+ * stays registered while disarmed and is rearmed by setting its deadline.
+ *
+ * Returns:
+ * 0      - On success
+ * ENOMEM - Unable to allocate memory to register
+ */
+int loop_register_timer(struct loop_timer *timer) {
+	if (num_timers >= max_timers) {
+		struct loop_timer **new_timers;
+		int new_size;
+
+		if (max_timers == 0)
+			new_size = MIN_ITEMS_SIZE;
+		else
+			new_size = 2 * max_timers;
+
+		new_timers = alloc_realloc(ALLOC_LOOP, timers, new_size * sizeof(*timers));
+		if (!new_timers)
+			return ENOMEM;
+
+		timers = new_timers;
+		max_timers = new_size;
+	}
+
+	timers[num_timers++] = timer;
+
+	return 0;
+}
+
+/*
+ * Unregister a loop_timer so it will no longer fire.
+ *
+ * Returns:
+ * 0 - On success
+ */
+int loop_deregister_timer(struct loop_timer *timer) {
+	int i;
+
+	for (i = 0; i < num_timers; i++)
+		if (timers[i] == timer)
+			break;
+
+	if (i == num_timers)
+		return 0;
+
+	timers[i] = timers[num_timers - 1];
+	num_timers--;
+
+	return 0;
+}
+
+/*
+ * Returns the poll timeout in milliseconds until the next armed timer
+ * fires, or -1 if no timer is armed.
+ */
+static int loop_timeout(void) {
+	uint64_t next = 0;
+	uint64_t now;
+
+	for (int i = 0; i < num_timers; i++)
+		if (timers[i]->deadline && (next == 0 || timers[i]->deadline < next))
+			next = timers[i]->deadline;
+
+	if (next == 0)
+		return -1;
+
+	now = clock_now_us();
+	if (next <= now)
+		return 0;
+
+	return (next - now + 999) / 1000;
+}
+
+/*
+ * Fire every armed timer whose deadline has passed.
+ */
+static void loop_run_timers(void) {
+	uint64_t now = clock_now_us();
+
+	for (int i = 0; i < num_timers; i++) {
+		if (timers[i]->deadline && timers[i]->deadline <= now) {
+			timers[i]->deadline = 0;
+			STATS_INC(GStats.timers_fired);
+			timers[i]->timer_callback(timers[i]);
+		}
+	}
+}
+
 static struct {
 	loop_signal_callback handler;
 	siginfo_t siginfo;
@@ -169,6 +274,7 @@ static void process_signals(struct loop_fd *fd, int revents) {
 			if (signal_callbacks[i].handler) {
 				DLOG("Received signal %d %d times: Handling", i,
 				     signal_callbacks[i].num_calls);
+				STATS_INC(GStats.signals);
 				signal_callbacks[i].handler(&signal_callbacks[i].siginfo,
 							    signal_callbacks[i].num_calls);
 				signal_callbacks[i].num_calls = 0;
@@ -190,14 +296,30 @@ static void process_signals(struct loop_fd *fd, int revents) {
  * handler.
  *
  * To unregister a handler simply register a NULL handler for the desired
- * signal.
+ * signal, which restores the default action. loop_init() must have been
+ * called first.
  */
 void loop_register_signal(int signal, loop_signal_callback callback) {
-	if (signal < 0 && signal >= NSIG)
+	struct sigaction sig;
+	int result;
+
+	if (signal <= 0 || signal >= NSIG)
 		return;
 
 	signal_callbacks[signal].handler = callback;
 	signal_callbacks[signal].num_calls = 0;
+
+	memset(&sig, 0, sizeof(sig));
+	if (callback) {
+		sig.sa_sigaction = signal_handler;
+		/* sig.sa_mask = 0; Not portable and unnecessary right now */
+		sig.sa_flags = SA_SIGINFO | SA_RESTART;
+	} else {
+		sig.sa_handler = SIG_DFL;
+	}
+
+	result = sigaction(signal, &sig, NULL);
+	DLOG("sigaction %d returned %d %d", signal, result, errno);
 }
 
 /*
@@ -211,7 +333,6 @@ void loop_register_signal(int signal, loop_signal_callback callback) {
 static int init_signals(void) {
 	int pipes[2];
 	int result;
-	struct sigaction sig;
 
 	result = pipe(pipes);
 	if (result == -1) {
@@ -227,13 +348,6 @@ static int init_signals(void) {
 	signal_fd.fd.poll_flags = POLLIN;
 	signal_fd.fd.poll_callback = process_signals;
 
-	memset(&sig, 0, sizeof(sig));
-	sig.sa_sigaction = signal_handler;
-	/* sig.sa_mask = 0; Not portable and unnecessary right now */
-	sig.sa_flags = SA_SIGINFO | SA_RESTART;
-	result = sigaction(SIGWINCH, &sig, NULL);
-	DLOG("sigaction returned %d %d", result, errno);
-
 	result = loop_register((struct loop_fd *)&signal_fd);
 	if (result)
 		return ENOMEM;
@@ -257,6 +371,14 @@ int loop_init(void) {
 	return result;
 }
 
+/*
+ * Returns the clock_now_us() time the loop last woke up, which is when
+ * whatever the callbacks are handling became ready.
+ */
+uint64_t loop_wakeup_time(void) {
+	return wakeup_time;
+}
+
 /*
  * Run the poll loop once, calling all the callbacks as necessary.
  *
@@ -273,8 +395,18 @@ bool loop_run(void) {
 		fds[i].events = loop_items[i].fd->poll_flags;
 
 poll:
-	result = pal_poll(fds, num_loop_items, -1);
-	if (result <= 0) {
+	/* About to wait, so this is the time to write out the log and recording */
+	log_flush();
+	record_flush();
+
+	STATS_INC(GStats.loop_iterations);
+	TRACE(TRACE_POLL_ENTER, TRACE_NO_BUFFER, num_loop_items);
+	result = pal_poll(fds, num_loop_items, loop_timeout());
+	wakeup_time = clock_now_us();
+	TRACE(TRACE_POLL_EXIT, TRACE_NO_BUFFER, result);
+	if (result > 0)
+		STATS_INC(GStats.loop_wakeups);
+	if (result < 0) {
 		if (errno == EINTR) {
 			/* Just received a signal, carry on */
 			goto poll;
@@ -290,5 +422,7 @@ poll:
 		}
 	}
 
+	loop_run_timers();
+
 	return true;
 }
@@ -18,6 +18,7 @@
 #define LOOP_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <signal.h>
 
 struct loop_fd {
@@ -30,12 +31,23 @@ struct loop_fd {
 	void (*poll_callback)(struct loop_fd *fd, int revents);
 };
 
+struct loop_timer {
+	/* clock_now_us() time at which to fire, 0 when the timer isn't armed */
+	uint64_t deadline;
+
+	/* Will be called once the deadline has passed. The timer is disarmed first */
+	void (*timer_callback)(struct loop_timer *timer);
+};
+
 typedef void (*loop_signal_callback)(siginfo_t *siginfo, int num_signals);
 
 bool loop_run(void);
+uint64_t loop_wakeup_time(void);
 int loop_init(void);
 int loop_register(struct loop_fd *fd);
 int loop_deregister(struct loop_fd *fd);
+int loop_register_timer(struct loop_timer *timer);
+int loop_deregister_timer(struct loop_timer *timer);
 void loop_register_signal(int signal, loop_signal_callback callback);
 
 #endif
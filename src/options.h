@@ -25,12 +25,24 @@ extern struct cmd_options {
 	int verbose; /* Logging verbosity level */
 	char new_buf_command[1024]; /* Command to run when opening a new buffer */
 	char session_name[128]; /* Name of this session to differentiate it from other sessions */
+	char profile_path[1024]; /* File prediction profiles are kept in between sessions */
+	char record_path[1024]; /* File to record the session to, if any */
+	int record_input; /* Should user input be recorded as well as slave output ? */
+	char replay_path[1024]; /* Recording to replay instead of running slaves, if any */
+	int replay_realtime; /* Should the replay be displayed in real time rather than as fast as possible ? */
+	char stats_path[1024]; /* File the stats are dumped to on SIGUSR1 */
+	char trace_path[1024]; /* File the trace is dumped to on SIGUSR2 and exit, tracing is off if empty */
+	char log_path[1024]; /* File to log to instead of stderr, if any */
+	int scrollback_lines; /* Lines kept above the screen, 0 for unlimited */
+	long memory_budget; /* KiB the session may allocate before old scrollback is freed, 0 for unlimited */
 	struct {
 		char meta; /* The key combination which accesses the meta terminal functionality */
 		char buffer_create; /* The key command which creates a new buffer */
 		char buffer_next; /* Change the current window to the next buffer */
 		char buffer_prev; /* Change the current window to the previous buffer */
 		char buffer_last; /* Change to the previous buffer */
+		char stats; /* Show the stats over the current buffer until the next key */
+		char memory; /* Show the memory use of each buffer until the next key */
 		char buffer_0; /* Change to buffer 0 */
 		char buffer_1; /* Change to buffer 1 */
 		char buffer_2; /* Change to buffer 2 */
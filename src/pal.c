@@ -20,6 +20,9 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <poll.h>
 #include <sys/select.h>
 
@@ -94,3 +97,44 @@ int pal_poll(struct pollfd fds[], nfds_t nfds, int timeout) {
 }
 
 #endif
+
+#if defined(__linux__)
+
+/*
+ * Retrieve the name of the program the given process is running.
+ *
+ * Returns:
+ * 0      - On success
+ * ENOENT - The process doesn't exist
+ */
+int pal_process_name(pid_t pid, char *name, int size) {
+	char path[64];
+	FILE *file;
+	int len;
+
+	snprintf(path, sizeof(path), "/proc/%d/comm", (int)pid);
+
+	file = fopen(path, "r");
+	if (!file)
+		return ENOENT;
+
+	if (!fgets(name, size, file)) {
+		fclose(file);
+		return ENOENT;
+	}
+	fclose(file);
+
+	len = strlen(name);
+	if (len > 0 && name[len - 1] == '\n')
+		name[len - 1] = '\0';
+
+	return 0;
+}
+
+#else
+
+int pal_process_name(pid_t pid, char *name, int size) {
+	return ENOSYS;
+}
+
+#endif
@@ -18,7 +18,9 @@
 #define PAL_H
 
 #include <poll.h>
+#include <sys/types.h>
 
 int pal_poll(struct pollfd fds[], nfds_t nfds, int timeout);
+int pal_process_name(pid_t pid, char *name, int size);
 
 #endif
@@ -16,81 +16,644 @@
  */
 /*
  * The core of the prediction engine
+ *
+ * Predictions are never fed through the terminal emulation. They are kept
+ * as an overlay of cells which is drawn over the buffer on the controller
+ * and dropped once the slave output either confirms or contradicts them.
  */
 #include <string.h>
 
 #include "buffer.h"
 #include "controller.h"
 #include "util.h"
+#include "log.h"
 #include "options.h"
+#include "clock.h"
+#include "loop.h"
+#include "tty.h"
+#include "pal.h"
+#include "profile.h"
+#include "trace.h"
 
 #include "predictor.h"
 
-static char backspaces[PREDICTOR_PREDICTION_LENGTH];
+static void predictor_timeout(struct loop_timer *timer);
 
 /*
  * Initialize the given predictor object.
  * 
  * Returns:
- * 0 - On success
+ * 0      - On success
+ * ENOMEM - Unable to register the prediction timer
  */
 int predictor_init(struct predictor *predictor) {
-	predictor->num_chars = 0;
-	predictor->num_echoed = 0;
-	predictor->history_used = 0;
-	memset(&predictor->history, 0, sizeof(predictor->history));
+	predictor->profile = profile_get("");
+	predictor->foreground = -1;
+	predictor->blocked = false;
+	predictor->epoch = 1;
+	predictor->confirmed_epoch = 0;
+	predictor->keys_used = 0;
+	predictor->next_seq = 0;
+	predictor->moved = false;
+	predictor->line_row = 0;
+	predictor->line_start = -1;
+	predictor->overlay_used = 0;
+	memset(&predictor->stats, 0, sizeof(predictor->stats));
+	predictor->srtt = 0;
+	predictor->rttvar = 0;
+	predictor->show = false;
 
-	if (backspaces[0] != '\b')
-		for (int i = 0; i < sizeof(backspaces); i++)
-			backspaces[i] = '\b';
+	predictor->timer.deadline = 0;
+	predictor->timer.timer_callback = predictor_timeout;
 
-	return 0;
+	return loop_register_timer(&predictor->timer);
 }
 
 void predictor_free(struct predictor *predictor) {
-	return;
+	loop_deregister_timer(&predictor->timer);
 }
 
 /*
- * Given the latest input from the user, output the best prediction of the
- * local echo to the windows of that buffer.
+ * Returns how long the slave is given to echo a key before it is assumed
+ * it never will.
  */
-static void predictor_output_guess(struct predictor *predictor, struct buffer *buffer, int size, char *input) {
-	int old_history_used;
-	bool predict;
-	int result;
+static uint64_t predictor_timeout_us(struct predictor *predictor) {
+	return max(PREDICTOR_TIMEOUT_US, predictor->srtt + 4 * predictor->rttvar);
+}
+
+/*
+ * Arm the timer to fire when the slave has taken too long to respond to
+ * the oldest key while predictions are outstanding.
+ */
+static void predictor_arm_timer(struct predictor *predictor) {
+	uint64_t timeout = predictor_timeout_us(predictor);
+
+	if ((predictor->overlay_used > 0 || predictor->moved) && predictor->keys_used > 0)
+		predictor->timer.deadline = predictor->keys[0].time + timeout;
+	else
+		predictor->timer.deadline = 0;
+}
+
+/*
+ * Fold a new round trip sample into the smoothed round trip time in the
+ * same way TCP does (RFC 6298) and decide whether predictions are worth
+ * displaying.
+ */
+static void predictor_update_rtt(struct predictor *predictor, uint64_t sample) {
+	uint64_t delta;
+
+	if (predictor->srtt == 0) {
+		predictor->srtt = sample;
+		predictor->rttvar = sample / 2;
+	} else {
+		if (sample > predictor->srtt)
+			delta = sample - predictor->srtt;
+		else
+			delta = predictor->srtt - sample;
+
+		predictor->rttvar = (3 * predictor->rttvar + delta) / 4;
+		predictor->srtt = (7 * predictor->srtt + sample) / 8;
+	}
+}
+
+/*
+ * Draw the overlay cells from first onwards to the controller, leaving the
+ * controller cursor at the predicted cursor.
+ */
+static void predictor_draw(struct predictor *predictor, struct buffer *buffer, int first) {
+	struct predictor_cell *pcell;
+	struct vt_cell cell;
+	uint64_t style = buffer->vt.current.flags & VT_ALL_STYLES;
+	int row = -1;
+	int col = -1;
+
+	if (!predictor->show)
+		return;
+
+	for (int i = first; i < predictor->overlay_used; i++) {
+		pcell = &predictor->overlay[i];
+
+		if (pcell->row != row || pcell->col != col)
+			buffer_goto(buffer, pcell->row, pcell->col);
+
+		cell.c = pcell->c;
+		cell.flags = VT_FLAG_CELL_SET | style;
+		if (pcell->epoch > predictor->confirmed_epoch)
+			cell.flags |= VT_STYLE_UNDERSCORE;
+		buffer_output_cell(buffer, &cell);
+		pcell->drawn = true;
+
+		row = pcell->row;
+		col = pcell->col + 1;
+	}
+
+	if (predictor->moved)
+		buffer_goto(buffer, predictor->cursor_row, predictor->cursor_col);
+}
+
+/*
+ * Remove the overlay cells from first onwards from the controller,
+ * restoring what the slave actually has in those cells.
+ */
+static void predictor_undraw(struct predictor *predictor, struct buffer *buffer, int first) {
+	struct predictor_cell *pcell;
+
+	if (!predictor->show || (first == predictor->overlay_used && !predictor->moved))
+		return;
+
+	for (int i = first; i < predictor->overlay_used; i++) {
+		pcell = &predictor->overlay[i];
+		predictor->stats.undo_bytes += buffer_goto(buffer, pcell->row, pcell->col);
+		predictor->stats.undo_bytes += buffer_output_cell(buffer,
+			vt_get_cell(buffer, pcell->row, pcell->col));
+	}
+
+	predictor->stats.undo_bytes += buffer_restore_cursor(buffer);
+}
+
+/*
+ * Erase the overlay cells from first onwards and start a new epoch. The
+ * cursor is predicted to be after the remaining predictions, if any.
+ */
+static void predictor_erase(struct predictor *predictor, struct buffer *buffer, int first) {
+	struct predictor_cell *last;
+
+	predictor_undraw(predictor, buffer, first);
+
+	predictor->stats.mispredicted += predictor->overlay_used - first;
+	TRACE(TRACE_PREDICT_MISS, buffer->bufid, predictor->overlay_used - first);
+	predictor->overlay_used = first;
+	predictor->epoch++;
+
+	/*
+	 * Keys still in flight no longer have predictions to follow on from,
+	 * they are predicted again once the oldest of them is answered.
+	 */
+	if (predictor->keys_used > 0 && !predictor->blocked) {
+		predictor->blocked = true;
+		predictor->blocked_seq = predictor->keys[0].seq;
+		predictor->replay = true;
+	}
+
+	if (predictor->overlay_used > 0) {
+		last = &predictor->overlay[predictor->overlay_used - 1];
+		predictor->cursor_row = last->row;
+		predictor->cursor_col = min(last->col + 1, buffer->vt.cols - 1);
+	} else {
+		predictor->moved = false;
+	}
+}
+
+/*
+ * Remove the given overlay cell from the overlay.
+ */
+static void predictor_remove(struct predictor *predictor, int i) {
+	predictor->overlay_used--;
+	memmove(predictor->overlay + i, predictor->overlay + i + 1,
+		(predictor->overlay_used - i) * sizeof(*predictor->overlay));
+}
+
+/*
+ * Returns whether the slave has responded to the key with the given
+ * sequence number.
+ */
+static bool predictor_answered(struct predictor *predictor, unsigned int seq) {
+	return predictor->keys_used == 0 || (int)(seq - predictor->keys[0].seq) < 0;
+}
+
+/*
+ * Returns whether the terminal emulation agrees with the given prediction.
+ */
+static bool predictor_matches(struct buffer *buffer, struct predictor_cell *pcell) {
+	struct vt_cell *cell = vt_get_cell(buffer, pcell->row, pcell->col);
+
+	if (!cell || !(cell->flags & VT_FLAG_CELL_SET))
+		return pcell->c == ' ';
+
+	return cell->c == pcell->c;
+}
+
+/*
+ * Returns the character predicted to be in the given cell, a space for
+ * blank cells.
+ */
+static char predictor_peek(struct predictor *predictor, struct buffer *buffer, int row, int col) {
+	struct vt_cell *cell;
+
+	for (int i = predictor->overlay_used - 1; i >= 0; i--)
+		if (predictor->overlay[i].row == row && predictor->overlay[i].col == col)
+			return predictor->overlay[i].c;
+
+	cell = vt_get_cell(buffer, row, col);
+	if (!cell || !(cell->flags & VT_FLAG_CELL_SET))
+		return ' ';
+
+	return cell->c;
+}
+
+/*
+ * Predict the given character in the given cell as the effect of the sent
+ * key, replacing any earlier prediction of that cell. first is lowered to
+ * the first overlay cell which needs to be redrawn.
+ */
+static void predictor_put(struct predictor *predictor, int row, int col, char c,
+			  struct predictor_key *sent, int *first) {
+	struct predictor_cell *pcell;
+
+	for (int i = 0; i < predictor->overlay_used; i++) {
+		if (predictor->overlay[i].row == row && predictor->overlay[i].col == col) {
+			predictor_remove(predictor, i);
+			*first = min(*first, i);
+			break;
+		}
+	}
+
+	pcell = &predictor->overlay[predictor->overlay_used++];
+	pcell->row = row;
+	pcell->col = col;
+	pcell->c = c;
+	pcell->epoch = predictor->epoch;
+	pcell->seq = sent->seq;
+	pcell->drawn = false;
+	pcell->time = sent->time;
+}
+
+/*
+ * Returns whether another num cells can be predicted.
+ */
+static bool predictor_room(struct predictor *predictor, int num) {
+	return predictor->overlay_used + num <= ARRAY_SIZE(predictor->overlay);
+}
+
+/*
+ * Returns the column just after the last character predicted on the input
+ * line.
+ */
+static int predictor_line_end(struct predictor *predictor, struct buffer *buffer) {
+	int col;
+
+	for (col = buffer->vt.cols; col > predictor->line_start; col--)
+		if (predictor_peek(predictor, buffer, predictor->line_row, col - 1) != ' ')
+			break;
+
+	return col;
+}
+
+/*
+ * Predict num characters being deleted at col with the rest of the input
+ * line moving left to fill the gap.
+ */
+static void predictor_delete(struct predictor *predictor, struct buffer *buffer, int col, int num,
+			     struct predictor_key *sent, int *first) {
+	int row = predictor->line_row;
+	int end = predictor_line_end(predictor, buffer);
+	char c;
+
+	for (int i = col; i < end; i++) {
+		c = i + num < end ? predictor_peek(predictor, buffer, row, i + num) : ' ';
+		predictor_put(predictor, row, i, c, sent, first);
+	}
+}
+
+/*
+ * Predict the effect of a key on the input line, in the way line editors
+ * such as readline and the line discipline handle it. Printable characters
+ * are inserted at the cursor and the common editing keys move the cursor
+ * or delete characters.
+ *
+ * Returns whether the effect of the key could be predicted.
+ */
+static bool predictor_edit(struct predictor *predictor, struct buffer *buffer, char *key, int len,
+			   enum key_class class, struct predictor_key *sent, int *first) {
+	int row;
+	int col;
+	int end;
+	int start;
+	int i;
+
+	if (!predictor->moved) {
+		predictor->cursor_row = buffer->vt.current.row;
+		predictor->cursor_col = buffer->vt.current.col;
+	}
+	row = predictor->cursor_row;
+	col = predictor->cursor_col;
+
+	if (predictor->line_start < 0 || predictor->line_row != row || predictor->line_start > col) {
+		predictor->line_row = row;
+		predictor->line_start = col;
+	}
+	start = predictor->line_start;
+	end = predictor_line_end(predictor, buffer);
+
+	if (class <= KEY_CLASS_SPACE) {
+		/* Insert, wrapping lines isn't predicted */
+		if (max(col, end) + 1 >= buffer->vt.cols ||
+		    !predictor_room(predictor, max(col, end) - col + 1))
+			return false;
+
+		for (i = end; i > col; i--)
+			predictor_put(predictor, row, i, predictor_peek(predictor, buffer, row, i - 1),
+				      sent, first);
+		predictor_put(predictor, row, col, key[0], sent, first);
+		col++;
+	} else if (len == 1 && (key[0] == 0x7f || key[0] == '\b')) {
+		/* Delete the previous character */
+		if (col <= start || !predictor_room(predictor, end - col + 1))
+			return false;
+
+		col--;
+		predictor_delete(predictor, buffer, col, 1, sent, first);
+	} else if ((len == 1 && key[0] == CONTROL('b')) || (len == 3 && key[2] == 'D')) {
+		/* Backward */
+		if (col <= start)
+			return false;
+		col--;
+	} else if ((len == 1 && key[0] == CONTROL('f')) || (len == 3 && key[2] == 'C')) {
+		/* Forward */
+		if (col >= end)
+			return false;
+		col++;
+	} else if ((len == 1 && key[0] == CONTROL('a')) || (len == 3 && key[2] == 'H')) {
+		/* Start of line */
+		col = start;
+	} else if ((len == 1 && key[0] == CONTROL('e')) || (len == 3 && key[2] == 'F')) {
+		/* End of line */
+		col = end;
+	} else if (len == 1 && key[0] == CONTROL('k')) {
+		/* Kill to the end of the line */
+		if (!predictor_room(predictor, end - col))
+			return false;
+
+		for (i = col; i < end; i++)
+			predictor_put(predictor, row, i, ' ', sent, first);
+	} else if (len == 1 && key[0] == CONTROL('u')) {
+		/* Kill to the start of the line */
+		if (!predictor_room(predictor, end - start))
+			return false;
+
+		predictor_delete(predictor, buffer, start, col - start, sent, first);
+		col = start;
+	} else if (len == 1 && key[0] == CONTROL('w')) {
+		/* Kill the previous whitespace delimited word */
+		if (!predictor_room(predictor, end - start))
+			return false;
+
+		i = col;
+		while (i > start && predictor_peek(predictor, buffer, row, i - 1) == ' ')
+			i--;
+		while (i > start && predictor_peek(predictor, buffer, row, i - 1) != ' ')
+			i--;
+
+		predictor_delete(predictor, buffer, i, col - i, sent, first);
+		col = i;
+	} else {
+		return false;
+	}
+
+	predictor->moved = true;
+	predictor->cursor_col = col;
+
+	return true;
+}
+
+/*
+ * Determine the class of the key at the start of the given input. Escape
+ * sequences, such as those sent by the cursor keys, are a single key.
+ *
+ * Returns the class of the key, with the number of bytes in the key in len.
+ */
+static enum key_class predictor_classify(char *input, int size, int *len) {
+	unsigned char c = input[0];
+	int i;
+
+	*len = 1;
+
+	if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+		return KEY_CLASS_ALNUM;
+	if (c == ' ')
+		return KEY_CLASS_SPACE;
+	if (c > ' ' && c <= '~')
+		return KEY_CLASS_PUNCT;
+	if (c == '\t')
+		return KEY_CLASS_TAB;
+	if (c == '\r' || c == '\n')
+		return KEY_CLASS_ENTER;
+	if (c == '\b' || c == 0x7f)
+		return KEY_CLASS_ERASE;
+	if (c >= 0x80)
+		return KEY_CLASS_HIGH;
+	if (c != '\033')
+		return KEY_CLASS_CONTROL;
+
+	if (size > 1 && (input[1] == '[' || input[1] == 'O')) {
+		/* CSI or SS3 sequence, up to and including the final byte */
+		for (i = 2; i < size; i++)
+			if (input[i] >= '@' && input[i] <= '~')
+				break;
+		*len = min(i + 1, size);
+	} else if (size > 1) {
+		/* Meta modified key */
+		*len = 2;
+	}
+
+	return KEY_CLASS_ESCAPE;
+}
 
-	old_history_used = predictor->history_used;
+/*
+ * Returns whether keys of the given class are echoed often enough to be
+ * worth predicting. Classes which haven't been seen yet are.
+ */
+static bool predictor_confident(struct profile *profile, enum key_class class) {
+	struct profile_class *stats = &profile->classes[class];
+
+	if (stats->num_chars == 0)
+		return true;
+
+	return (stats->num_echoed * 100) / stats->num_chars >= PREDICTOR_ECHO_PERCENTAGE;
+}
+
+/*
+ * Account for whether the given key was echoed in the statistics of its
+ * class.
+ */
+static void predictor_count_key(struct predictor_key *key, bool echoed) {
+	struct profile_class *stats = &key->profile->classes[key->class];
 
 	/* Normalize to avoid integer overflow */
-	if (predictor->num_chars > 1000000) {
-		predictor->num_chars /= 2;
-		predictor->num_echoed /= 2;
+	if (stats->num_chars > PROFILE_MAX_KEYS) {
+		stats->num_chars /= 2;
+		stats->num_echoed /= 2;
+	}
+
+	stats->num_chars++;
+	if (echoed)
+		stats->num_echoed++;
+}
+
+/*
+ * Remove the given number of keys from the front of the unechoed keys.
+ */
+static void predictor_drop_keys(struct predictor *predictor, int num) {
+	predictor->keys_used -= num;
+	memmove(predictor->keys, predictor->keys + num,
+		predictor->keys_used * sizeof(*predictor->keys));
+}
+
+/*
+ * Remember a key sent to the slave until its echo is seen.
+ *
+ * Returns the key remembered.
+ */
+static struct predictor_key *predictor_record_key(struct predictor *predictor, char c,
+						 enum key_class class, uint64_t now) {
+	struct predictor_key *key;
+
+	if (predictor->keys_used == ARRAY_SIZE(predictor->keys)) {
+		/* The oldest key is never going to be echoed */
+		predictor_count_key(&predictor->keys[0], false);
+		predictor_drop_keys(predictor, 1);
 	}
 
-	if (predictor->num_chars == 0)
-		predict = true;
+	key = &predictor->keys[predictor->keys_used++];
+	key->c = c;
+	key->class = class;
+	key->seq = predictor->next_seq++;
+	predictor->stats.keys++;
+	key->time = now;
+	key->profile = predictor->profile;
+
+	return key;
+}
+
+/*
+ * Switch to the profile of the program in the foreground of the buffer.
+ * Only the process group is checked on every keystroke, the program name
+ * is looked up when it changes.
+ */
+static void predictor_update_profile(struct predictor *predictor, struct buffer *buffer) {
+	char name[PROFILE_NAME_LEN];
+	pid_t foreground;
+
+	foreground = tty_foreground(buffer->fd.fd);
+	if (foreground == predictor->foreground)
+		return;
+
+	predictor->foreground = foreground;
+	if (foreground < 0 || pal_process_name(foreground, name, sizeof(name)))
+		name[0] = '\0';
+
+	predictor->profile = profile_get(name);
+	DLOG("Buffer %d foreground is now %d '%s'", buffer->bufid, foreground, name);
+}
+
+/*
+ * Predict the effect of the sent key, whose bytes are given, or block
+ * prediction until the slave answers it if that can't be done.
+ */
+static void predictor_guess_key(struct predictor *predictor, struct buffer *buffer,
+				struct predictor_key *sent, char *key, int len, int *first) {
+	enum key_class class = sent->class;
+	bool confident;
+
+	/*
+	 * Editing keys are only worth predicting when what is typed
+	 * is echoed, which is when a line editor is running.
+	 */
+	if (class <= KEY_CLASS_SPACE)
+		confident = predictor_confident(sent->profile, class);
 	else
-		predict = (predictor->num_echoed * 100) / predictor->num_chars
-			>= PREDICTOR_ECHO_PERCENTAGE;
+		confident = predictor_confident(sent->profile, KEY_CLASS_ALNUM);
 
-	if (predict && sizeof(predictor->history) - predictor->history_used >= size) {
+	if (confident && predictor_edit(predictor, buffer, key, len, class, sent, first)) {
+		predictor->stats.predicted++;
+		TRACE(TRACE_PREDICT, buffer->bufid, (unsigned char)key[0]);
+	} else {
 		/*
-		 * We have room so we can try to predict. We only predict
-		 * whole input pieces to attempt to avoid cutting escape
-		 * code in half. It's not perfect, but it should be good
-		 * enough until we get more smarts about escape codes.
+		 * This key moves the cursor in ways we can't follow
+		 * until the slave responds.
 		 */
-		memcpy(predictor->history + predictor->history_used,
-		       input, size);
-		predictor->history_used += size;
-
-		result = buffer_input(buffer, size, input);
-		if (result != 0) {
-			/* We've failed to output, pretend we didn't do anything */
-			predictor->history_used = old_history_used;
+		predictor->blocked = true;
+		predictor->blocked_seq = sent->seq;
+		predictor->replay = false;
+		predictor->line_start = -1;
+		predictor->epoch++;
+		TRACE(TRACE_PREDICT_BLOCKED, buffer->bufid, (unsigned char)key[0]);
+	}
+}
+
+/*
+ * The slave has answered the key prediction was blocked on. When the keys
+ * in flight were only blocked because their predictions were erased,
+ * predict them again from where the slave has now put the cursor.
+ */
+static void predictor_catch_up(struct predictor *predictor, struct buffer *buffer) {
+	struct predictor_key *sent;
+	int first = 0;
+
+	/* Anything still predicted was guessed before the slave caught up */
+	if (predictor->overlay_used > 0) {
+		predictor_undraw(predictor, buffer, 0);
+		predictor->overlay_used = 0;
+	}
+
+	predictor->blocked = false;
+	predictor->moved = false;
+
+	for (int i = 0; i < predictor->keys_used && predictor->replay; i++) {
+		sent = &predictor->keys[i];
+
+		/* Only the first byte of an escape sequence is remembered */
+		if (sent->class != KEY_CLASS_ESCAPE)
+			predictor_guess_key(predictor, buffer, sent, &sent->c, 1, &first);
+
+		if (sent->class == KEY_CLASS_ESCAPE || predictor->blocked) {
+			/* Nothing after it can be followed either */
+			predictor->blocked = true;
+			predictor->blocked_seq = predictor->keys[predictor->keys_used - 1].seq;
+			predictor->replay = false;
+			predictor->line_start = -1;
 		}
 	}
+
+	predictor_draw(predictor, buffer, first);
+	predictor_arm_timer(predictor);
+}
+
+/*
+ * Given the latest input from the user, output the best prediction of the
+ * local echo to the windows of that buffer. Predictions are always tracked
+ * so the round trip time can be measured, but are only drawn when the
+ * link is slow enough for them to help.
+ */
+static void predictor_output_guess(struct predictor *predictor, struct buffer *buffer, int size, char *input) {
+	struct predictor_key *sent;
+	enum key_class class;
+	int first = predictor->overlay_used;
+	uint64_t now = clock_now_us();
+	int len;
+
+	predictor_update_profile(predictor, buffer);
+
+	if (!tty_may_echo(buffer->fd.fd)) {
+		/* The slave won't echo, anything outstanding is wrong */
+		if (predictor->overlay_used > 0 || predictor->moved)
+			predictor_erase(predictor, buffer, 0);
+		return;
+	}
+
+	for (int i = 0; i < size; i += len) {
+		class = predictor_classify(input + i, size - i, &len);
+		sent = predictor_record_key(predictor, input[i], class, now);
+
+		if (!predictor->blocked)
+			predictor_guess_key(predictor, buffer, sent, input + i, len, &first);
+		else if (!predictor->replay)
+			/* The slave has to answer this key before predicting again */
+			predictor->blocked_seq = sent->seq;
+	}
+
+	predictor_draw(predictor, buffer, first);
+	predictor_arm_timer(predictor);
 }
 
 /*
@@ -104,64 +667,174 @@ static void predictor_output_guess(struct predictor *predictor, struct buffer *b
  */
 int predictor_output(struct predictor *predictor, struct buffer *buffer, int size, char *input,
 		     int (*outfunc)(struct buffer *buffer, int size, char *buf)) {
-	if (cmd_options.predict)
+	int result;
+
+	result = outfunc(buffer, size, input);
+	if (result == 0 && cmd_options.predict)
 		predictor_output_guess(predictor, buffer, size, input);
-	return outfunc(buffer, size, input);
+
+	return result;
 }
 
 /*
- * Given the latest output from the terminal, replace any correct prediction
- * with the confirmed output, undo any incorrect prediction and re-output the
- * new predicted characters.
- *
- * Returns:
- * 0      - On success
- * EAGAIN - Controller buffer didn't have sufficient space
+ * Learn which of the keys sent to the slave the latest output echoed. The
+ * output is matched against the oldest keys, any key skipped over to find
+ * a match wasn't echoed. Neither was the oldest key if the output ends in
+ * something other than an echo, nor any key which has waited too long.
+ * Keys sent too recently for the slave to have answered them yet are left
+ * alone, so output such as a command printing a line isn't mistaken for
+ * the echo of what is typed next.
  */
-int predictor_learn(struct predictor *predictor, struct buffer *buffer, int size, char *output) {
-	int n;
-	int result;
+static void predictor_count_echo(struct predictor *predictor, int size, char *output) {
+	uint64_t now = clock_now_us();
+	uint64_t timeout = predictor_timeout_us(predictor);
+	bool unmatched = false;
+	int answerable = 0;
+	int lookahead;
+	int n = 0;
+	int i;
+	int j;
 
-	if (cmd_options.predict) {
-		/*
-		 * Find the first difference between what we predicted and what
-		 * actually came back.
-		 */
-		for (n = 0; n < predictor->history_used && n < size; n++) {
-			predictor->num_chars++;
+	while (n < predictor->keys_used && now - predictor->keys[n].time > timeout)
+		predictor_count_key(&predictor->keys[n++], false);
+
+	/* Keys are in the order sent, so the ones old enough come first */
+	while (answerable < predictor->keys_used &&
+	       now - predictor->keys[answerable].time >= predictor->srtt / 2)
+		answerable++;
 
-			if (output[n] != predictor->history[n])
+	for (i = 0; i < size && n < answerable; i++) {
+		lookahead = min(answerable, n + PREDICTOR_ECHO_LOOKAHEAD);
+
+		for (j = n; j < lookahead; j++)
+			if (predictor->keys[j].c == output[i])
 				break;
 
-			predictor->num_echoed++;
-		}
+		unmatched = j == lookahead;
+		if (unmatched)
+			continue;
+
+		while (n < j)
+			predictor_count_key(&predictor->keys[n++], false);
+		predictor_count_key(&predictor->keys[n++], true);
+	}
 
-		if (output[n] != predictor->history[n]) {
-			/*
-			 * We weren't perfect up to the end. First figure out how
-			 * many characters were not echoed immediately to get
-			 * better.
-			 */
-			predictor->num_chars += min(predictor->history_used - n, size - n);
+	if (unmatched && n < answerable)
+		predictor_count_key(&predictor->keys[n++], false);
+
+	predictor_drop_keys(predictor, n);
+}
+
+/*
+ * Compare the overlay against the terminal emulation after new output.
+ * Predictions the slave agrees with are confirmed and dropped, which also
+ * confirms their epoch. Once the slave has responded to the key which made
+ * a prediction without agreeing with it the whole epoch of that prediction,
+ * and every later one, is wrong and erased. Anything else is still pending
+ * and is redrawn since the output may have drawn over it.
+ */
+static void predictor_reconcile(struct predictor *predictor, struct buffer *buffer) {
+	struct predictor_cell *pcell;
+	uint64_t now = clock_now_us();
+	uint64_t sample_time = 0;
+	int i;
+
+	for (i = 0; i < predictor->overlay_used;) {
+		pcell = &predictor->overlay[i];
+
+		if (!predictor_matches(buffer, pcell)) {
+			i++;
+			continue;
 		}
 
-		/* Undo all the prediction to replay the correct sequence */
-		buffer_input(buffer, predictor->history_used, backspaces);
+		predictor->confirmed_epoch = max(predictor->confirmed_epoch, pcell->epoch);
+		predictor->stats.confirmed++;
+		TRACE(TRACE_PREDICT_CONFIRM, buffer->bufid, now - pcell->time);
+		if (!pcell->drawn)
+			predictor->stats.display_us += now - pcell->time;
+
+		/* The newest answered keystroke has waited least behind others */
+		if (predictor_answered(predictor, pcell->seq))
+			sample_time = max(sample_time, pcell->time);
+
+		predictor_remove(predictor, i);
 	}
 
-	/* Output the actual output */
-	result = buffer_input(buffer, size, output);
+	if (sample_time != 0)
+		predictor_update_rtt(predictor, now - sample_time);
 
-	if (cmd_options.predict) {
-		predictor->history_used = max(0, predictor->history_used - size);
-		memmove(predictor->history, predictor->history + size, predictor->history_used);
+	if (predictor->show && predictor->srtt < PREDICTOR_RTT_HIDE_US) {
+		predictor_undraw(predictor, buffer, 0);
+		predictor->show = false;
+	} else if (!predictor->show && predictor->srtt > PREDICTOR_RTT_SHOW_US) {
+		predictor->show = true;
+	}
 
-		if (result == 0 && predictor->history_used > 0) {
-			/* Reoutput the prediction */
-			buffer_input(buffer, predictor->history_used, predictor->history);
-		}
+	for (i = 0; i < predictor->overlay_used; i++) {
+		pcell = &predictor->overlay[i];
+
+		if (!predictor_answered(predictor, pcell->seq))
+			continue;
+
+		/* Mispredicted, throw away the whole epoch */
+		while (i > 0 && predictor->overlay[i - 1].epoch == pcell->epoch)
+			i--;
+		predictor_erase(predictor, buffer, i);
+		break;
 	}
 
+	/* Once every key has been answered the slave knows best */
+	if (predictor->keys_used == 0)
+		predictor->moved = false;
+
+	predictor_draw(predictor, buffer, 0);
+	predictor_arm_timer(predictor);
+}
+
+/*
+ * The slave hasn't confirmed the oldest prediction in time. Assume all the
+ * outstanding predictions are wrong.
+ */
+static void predictor_timeout(struct loop_timer *timer) {
+	struct predictor *predictor = container_of(timer, struct predictor, timer);
+	struct buffer *buffer = container_of(predictor, struct buffer, predictor);
+
+	predictor_erase(predictor, buffer, 0);
+}
+
+/*
+ * Given the latest output from the terminal, pass it through the terminal
+ * emulation and reconcile the outstanding predictions with it.
+ *
+ * Returns:
+ * 0      - On success
+ * EAGAIN - Controller buffer didn't have sufficient space
+ */
+int predictor_learn(struct predictor *predictor, struct buffer *buffer, int size, char *output) {
+	int result;
+	bool pending = predictor->overlay_used > 0 || predictor->moved;
+
+	if (predictor->keys_used > 0)
+		predictor_count_echo(predictor, size, output);
+
+	/* The output expects the cursor where the slave left it */
+	if (pending && predictor->show)
+		buffer_restore_cursor(buffer);
+
+	result = buffer_input(buffer, size, output);
+
+	if (pending)
+		predictor_reconcile(predictor, buffer);
+
+	if (predictor->blocked && predictor_answered(predictor, predictor->blocked_seq))
+		predictor_catch_up(predictor, buffer);
+
 	return result;
 }
 
+/*
+ * Draw the outstanding predictions over a freshly redrawn buffer.
+ */
+void predictor_redraw(struct predictor *predictor, struct buffer *buffer) {
+	predictor_draw(predictor, buffer, 0);
+}
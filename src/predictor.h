@@ -22,25 +22,182 @@
 #ifndef PREDICTOR_H
 #define PREDICTOR_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "loop.h"
+
 struct buffer;
+struct profile;
 
 #define PREDICTOR_PREDICTION_LENGTH 128
 
 /*
- * If this percentage of characters or more have been echoed after user input
- * predict that they'll continue to be output directly.
+ * If this percentage of the keys in a class or more have been echoed after
+ * user input predict that keys of that class will continue to be output
+ * directly.
  */
 #define PREDICTOR_ECHO_PERCENTAGE 70
 
+/*
+ * How many keys ahead of the oldest unechoed key the slave output is
+ * matched against. Keys skipped over were not echoed.
+ */
+#define PREDICTOR_ECHO_LOOKAHEAD 4
+
+/*
+ * Predictions which the slave hasn't confirmed within this many
+ * microseconds, or four deviations past the smoothed round trip time if
+ * that is longer, are assumed wrong and erased.
+ */
+#define PREDICTOR_TIMEOUT_US (1000 * 1000)
+
+/*
+ * Predictions are only displayed once the smoothed round trip time to the
+ * slave rises above PREDICTOR_RTT_SHOW_US and stop being displayed when it
+ * falls below PREDICTOR_RTT_HIDE_US. On fast links the real echo arrives
+ * before a prediction would help.
+ */
+#define PREDICTOR_RTT_SHOW_US (30 * 1000)
+#define PREDICTOR_RTT_HIDE_US (20 * 1000)
+
+/*
+ * A predicted character drawn over the terminal emulation. A space
+ * predicts the cell was erased.
+ */
+struct predictor_cell {
+	uint16_t row;
+	uint16_t col;
+	char c;
+
+	/* The epoch the prediction was made in */
+	unsigned int epoch;
+	/* Sequence number of the key which made the prediction */
+	unsigned int seq;
+	/* Whether the prediction has been drawn to the controller */
+	bool drawn;
+	/* clock_now_us() time the prediction was made */
+	uint64_t time;
+};
+
+/*
+ * A key sent to the slave which hasn't been seen echoed yet.
+ */
+struct predictor_key {
+	/* The first byte of the key */
+	char c;
+	/* enum key_class of the key */
+	uint8_t class;
+	/* Sequence number of the key, counting every key sent */
+	unsigned int seq;
+	/* clock_now_us() time the key was sent */
+	uint64_t time;
+	/* Profile of the program the key was sent to */
+	struct profile *profile;
+};
+
+/*
+ * Running totals of how well the predictor is doing.
+ */
+struct predictor_stats {
+	/* Keys sent to the slave */
+	unsigned long keys;
+	/* Keys whose effect was predicted */
+	unsigned long predicted;
+	/* Predicted cells the slave agreed with */
+	unsigned long confirmed;
+	/* Predicted cells erased as wrong or timed out */
+	unsigned long mispredicted;
+	/* Bytes output to the controller to erase predictions */
+	unsigned long undo_bytes;
+	/*
+	 * Total microseconds between confirmed predictions being made and
+	 * the user seeing them, either drawn as predictions or echoed.
+	 */
+	uint64_t display_us;
+};
+
 struct predictor {
-	/* Number of characters seen */
-	int num_chars;
-	/* Number of characters which ended up being echoed verbatim */
-	int num_echoed;
-
-	/* The predicted characters which have been echoed out */
-	int history_used;
-	char history[PREDICTOR_PREDICTION_LENGTH];
+	/*
+	 * Echo statistics of the program in the foreground of the buffer,
+	 * which is looked up again whenever the foreground process group
+	 * changes.
+	 */
+	struct profile *profile;
+	pid_t foreground;
+
+	/*
+	 * Input was sent which can't be predicted, so the cursor position
+	 * is unknown until the slave responds to every key up to the one
+	 * with blocked_seq. Keys sent while blocked join the wait, unless
+	 * replay is set because only the predictions of keys in flight were
+	 * erased, in which case the keys after blocked_seq are predicted
+	 * again once it is answered.
+	 */
+	bool blocked;
+	bool replay;
+	unsigned int blocked_seq;
+
+	/*
+	 * Predictions are grouped into epochs. A new epoch starts whenever
+	 * input is sent which can't be predicted or a prediction turns out
+	 * wrong, since the slave may now be doing something completely
+	 * different. Predictions in epochs newer than the last one with a
+	 * confirmed prediction are tentative and shown underlined.
+	 */
+	unsigned int epoch;
+	unsigned int confirmed_epoch;
+
+	/* Fires when the oldest outstanding prediction times out */
+	struct loop_timer timer;
+
+	/*
+	 * Smoothed round trip time between a keystroke and the slave output
+	 * confirming it, and its mean deviation, in microseconds. Both are
+	 * zero until the first prediction is confirmed.
+	 */
+	uint64_t srtt;
+	uint64_t rttvar;
+
+	/* Whether predictions are currently drawn to the controller */
+	bool show;
+
+	/*
+	 * Every key sent to the slave which hasn't been echoed yet, predicted
+	 * or not, in the order they were typed. The echo statistics are
+	 * learnt from these.
+	 */
+	int keys_used;
+	struct predictor_key keys[PREDICTOR_PREDICTION_LENGTH];
+	unsigned int next_seq;
+
+	/*
+	 * Where the cursor is predicted to be once the slave has responded
+	 * to every key. Only valid while moved is set, otherwise the cursor
+	 * is wherever the slave left it.
+	 */
+	bool moved;
+	uint16_t cursor_row;
+	uint16_t cursor_col;
+
+	/*
+	 * The column input started at on line_row, which editing keys can't
+	 * move before. Negative when unknown, such as after a key which
+	 * couldn't be predicted.
+	 */
+	uint16_t line_row;
+	int line_start;
+
+	/*
+	 * The predicted characters which have been drawn but not yet
+	 * confirmed by the slave, in the order they were predicted. There
+	 * is at most one prediction per cell.
+	 */
+	int overlay_used;
+	struct predictor_cell overlay[PREDICTOR_PREDICTION_LENGTH];
+
+	struct predictor_stats stats;
 };
 
 int predictor_init(struct predictor *predictor);
@@ -48,5 +205,6 @@ void predictor_free(struct predictor *predictor);
 int predictor_output(struct predictor *predictor, struct buffer *buffer, int size, char *input,
 		     int (*outfunc)(struct buffer *buffer, int size, char *buf));
 int predictor_learn(struct predictor *predictor, struct buffer *buffer, int size, char *output);
+void predictor_redraw(struct predictor *predictor, struct buffer *buffer);
 
 #endif
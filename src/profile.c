@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Prediction profiles are shared by every buffer running the same program
+ * and are saved between sessions, so prediction starts out knowing how
+ * programs which have been seen before echo.
+ *
+ * The profile file is text, a version line followed by one line per
+ * program with the statistics of each key class in order. Program names
+ * can contain spaces, such as "tmux: server", so end at a tab:
+ *
+ * <name>\t<num_chars> <num_echoed> <num_chars> <num_echoed> ...
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "util.h"
+#include "profile.h"
+
+#define PROFILE_VERSION "tachyon-profile 3"
+
+/* Still read, names in it end at the first space */
+#define PROFILE_VERSION_SPACES "tachyon-profile 2"
+
+/* Entry 0 is the unnamed profile used for unknown programs */
+static struct profile profiles[PROFILE_MAX];
+static int num_profiles = 1;
+
+/*
+ * Find the profile for the named program, creating it if it doesn't exist.
+ * Never fails, unknown programs or programs which don't fit share the
+ * unnamed profile.
+ */
+struct profile *profile_get(const char *name) {
+	struct profile *profile;
+	char clean[PROFILE_NAME_LEN] = "";
+
+	if (name[0] == '\0')
+		return &profiles[0];
+
+	/* Tabs and newlines delimit the profile file */
+	strncpy(clean, name, sizeof(clean) - 1);
+	for (char *c = clean; *c; c++)
+		if (*c == '\t' || *c == '\n')
+			*c = ' ';
+
+	for (int i = 1; i < num_profiles; i++)
+		if (strcmp(profiles[i].name, clean) == 0)
+			return &profiles[i];
+
+	if (num_profiles == ARRAY_SIZE(profiles))
+		return &profiles[0];
+
+	profile = &profiles[num_profiles++];
+	memset(profile, 0, sizeof(*profile));
+	strcpy(profile->name, clean);
+
+	return profile;
+}
+
+/*
+ * Load previously saved profiles.
+ *
+ * Returns:
+ * 0      - On success
+ * ENOENT - The profile file couldn't be opened
+ * EINVAL - The profile file isn't in a known format
+ */
+int profile_load(const char *path) {
+	struct profile_class classes[KEY_CLASS_MAX];
+	char line[512];
+	char name[PROFILE_NAME_LEN];
+	char delimiter = '\t';
+	char *pos;
+	int len;
+	int i;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file)
+		return ENOENT;
+
+	if (!fgets(line, sizeof(line), file)) {
+		fclose(file);
+		return EINVAL;
+	}
+
+	if (strncmp(line, PROFILE_VERSION_SPACES, sizeof(PROFILE_VERSION_SPACES) - 1) == 0) {
+		delimiter = ' ';
+	} else if (strncmp(line, PROFILE_VERSION, sizeof(PROFILE_VERSION) - 1) != 0) {
+		fclose(file);
+		return EINVAL;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		pos = strchr(line, delimiter);
+		if (!pos || pos == line)
+			continue;
+
+		len = min(pos - line, sizeof(name) - 1);
+		memcpy(name, line, len);
+		name[len] = '\0';
+
+		pos++;
+		for (i = 0; i < KEY_CLASS_MAX; i++) {
+			if (sscanf(pos, "%d %d%n", &classes[i].num_chars,
+				   &classes[i].num_echoed, &len) != 2)
+				break;
+			pos += len;
+
+			if (classes[i].num_chars < 0 || classes[i].num_echoed < 0 ||
+			    classes[i].num_echoed > classes[i].num_chars)
+				break;
+
+			while (classes[i].num_chars > PROFILE_MAX_KEYS) {
+				classes[i].num_chars /= 2;
+				classes[i].num_echoed /= 2;
+			}
+		}
+
+		if (i != KEY_CLASS_MAX) {
+			DLOG("Ignoring invalid profile line '%s'", line);
+			continue;
+		}
+
+		memcpy(profile_get(name)->classes, classes, sizeof(classes));
+	}
+
+	fclose(file);
+
+	return 0;
+}
+
+/*
+ * Save all the named profiles. The file is replaced atomically so
+ * concurrent sessions never see a partially written file. Sessions don't
+ * merge what they learnt though, the last one to exit wins.
+ *
+ * Returns:
+ * 0      - On success
+ * EIO    - Unable to write the profile file
+ */
+int profile_save(const char *path) {
+	char tmp_path[1024 + 8];
+	FILE *file;
+	int result = 0;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+
+	file = fopen(tmp_path, "w");
+	if (!file)
+		return EIO;
+
+	fprintf(file, "%s\n", PROFILE_VERSION);
+	for (int i = 1; i < num_profiles; i++) {
+		fprintf(file, "%s\t", profiles[i].name);
+		for (int j = 0; j < KEY_CLASS_MAX; j++)
+			fprintf(file, "%s%d %d", j ? " " : "", profiles[i].classes[j].num_chars,
+				profiles[i].classes[j].num_echoed);
+		fprintf(file, "\n");
+	}
+
+	if (fclose(file) != 0)
+		result = EIO;
+
+	if (result == 0 && rename(tmp_path, path) != 0)
+		result = EIO;
+
+	if (result != 0)
+		remove(tmp_path);
+
+	return result;
+}
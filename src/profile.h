@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Header for prediction profiles, the echo statistics learnt for each
+ * program which runs in the foreground of a buffer.
+ */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*
+ * Maximum length of a program name, matching what Linux keeps in
+ * /proc/<pid>/comm.
+ */
+#define PROFILE_NAME_LEN 16
+
+/*
+ * Maximum number of programs profiled. Once full every other program
+ * shares the unnamed profile.
+ */
+#define PROFILE_MAX 64
+
+/*
+ * Keys are grouped into classes which programs tend to echo alike. A shell
+ * echoes letters but not Tab, a pager echoes neither.
+ */
+enum key_class {
+	KEY_CLASS_ALNUM,
+	KEY_CLASS_PUNCT,
+	KEY_CLASS_SPACE,
+	KEY_CLASS_TAB,
+	KEY_CLASS_ENTER,
+	KEY_CLASS_ERASE,
+	KEY_CLASS_CONTROL,
+	KEY_CLASS_ESCAPE,
+	KEY_CLASS_HIGH,
+	KEY_CLASS_MAX
+};
+
+/*
+ * Once a class has seen more keys than this its counts are halved, so they
+ * can't overflow and recent behaviour keeps some weight.
+ */
+#define PROFILE_MAX_KEYS (1000 * 1000)
+
+struct profile_class {
+	/* Number of keys seen */
+	int num_chars;
+	/* Number of keys which ended up being echoed verbatim */
+	int num_echoed;
+};
+
+struct profile {
+	char name[PROFILE_NAME_LEN];
+
+	struct profile_class classes[KEY_CLASS_MAX];
+};
+
+struct profile *profile_get(const char *name);
+int profile_load(const char *path);
+int profile_save(const char *path);
+
+#endif
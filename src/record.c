@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Session recordings are written as the session runs so they can later be
+ * replayed or used to evaluate changes to the predictor. Recording what the
+ * user types is optional since it includes anything typed without echo,
+ * such as passwords.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "clock.h"
+#include "log.h"
+#include "record.h"
+
+#define RECORD_FILE_BUFFER (64 * 1024)
+
+static FILE *record_file;
+static char record_buffer[RECORD_FILE_BUFFER];
+static int record_input_enabled;
+
+/*
+ * Start recording the session to the given file.
+ *
+ * Returns:
+ * 0      - On success
+ * ENOENT - Unable to create the file
+ * EIO    - Unable to write the file
+ */
+int record_open(const char *path, int record_input) {
+	record_file = fopen(path, "wb");
+	if (!record_file)
+		return ENOENT;
+
+	setvbuf(record_file, record_buffer, _IOFBF, sizeof(record_buffer));
+
+	if (fwrite(RECORD_MAGIC, sizeof(RECORD_MAGIC) - 1, 1, record_file) != 1) {
+		fclose(record_file);
+		record_file = NULL;
+		return EIO;
+	}
+
+	record_input_enabled = record_input;
+
+	return 0;
+}
+
+/*
+ * Write out the events buffered since the last flush, so a session killed
+ * without exiting loses at most what happened since.
+ */
+void record_flush(void) {
+	if (!record_file)
+		return;
+
+	if (fflush(record_file)) {
+		ELOG("Unable to write recording, stopping");
+		record_close();
+	}
+}
+
+void record_close(void) {
+	if (!record_file)
+		return;
+
+	fclose(record_file);
+	record_file = NULL;
+}
+
+/*
+ * Append an event to the recording, if one is being made. Recording stops
+ * at the first write error.
+ */
+void record_event(int type, int bufid, int size, const char *data) {
+	struct record_event event;
+
+	if (!record_file || (type == RECORD_INPUT && !record_input_enabled))
+		return;
+
+	memset(&event, 0, sizeof(event));
+	event.time = clock_now_us();
+	event.len = size;
+	event.type = type;
+	event.bufid = bufid;
+
+	if (fwrite(&event, sizeof(event), 1, record_file) != 1 ||
+	    (size > 0 && fwrite(data, size, 1, record_file) != 1)) {
+		ELOG("Unable to write recording, stopping");
+		record_close();
+	}
+}
+
+void record_resize(int bufid, int rows, int cols) {
+	struct record_size size = {rows, cols};
+
+	record_event(RECORD_RESIZE, bufid, sizeof(size), (char *)&size);
+}
+
+/*
+ * Check the given file is a recording, leaving it positioned at the first
+ * event.
+ *
+ * Returns:
+ * 0      - On success
+ * EINVAL - The file isn't a recording
+ */
+int record_read_header(FILE *file) {
+	char magic[sizeof(RECORD_MAGIC) - 1];
+
+	if (fread(magic, sizeof(magic), 1, file) != 1 ||
+	    memcmp(magic, RECORD_MAGIC, sizeof(magic)) != 0)
+		return EINVAL;
+
+	return 0;
+}
+
+/*
+ * Read the next event from a recording. The data of the event is stored in
+ * the given buffer. A session which was killed can leave its last event
+ * partly written, which is taken as the end of the recording.
+ *
+ * Returns:
+ * 0      - On success
+ * ENOENT - The end of the recording has been reached
+ * EINVAL - The recording can't be read or the event doesn't fit
+ */
+int record_read(FILE *file, struct record_event *event, char *data, int size) {
+	if (fread(event, sizeof(*event), 1, file) != 1)
+		return feof(file) ? ENOENT : EINVAL;
+
+	if (event->len > size)
+		return EINVAL;
+
+	if (event->len > 0 && fread(data, event->len, 1, file) != 1)
+		return feof(file) ? ENOENT : EINVAL;
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Header for session recordings, a binary log of what passed between the
+ * buffers and their slaves.
+ */
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define RECORD_MAGIC "TACHREC1"
+
+/* Types of recorded events */
+#define RECORD_OUTPUT 1 /* Bytes read from the slave */
+#define RECORD_INPUT  2 /* Bytes typed by the user and sent to the slave */
+#define RECORD_RESIZE 3 /* The buffer changed size, data is struct record_size */
+
+/*
+ * Every event in a recording starts with this header, followed by len
+ * bytes of data. All fields are in host byte order.
+ */
+struct record_event {
+	/* clock_now_us() time the event happened */
+	uint64_t time;
+	uint32_t len;
+	uint8_t type;
+	uint8_t bufid;
+	uint16_t reserved;
+};
+
+struct record_size {
+	uint16_t rows;
+	uint16_t cols;
+};
+
+int record_open(const char *path, int record_input);
+void record_flush(void);
+void record_close(void);
+void record_event(int type, int bufid, int size, const char *data);
+void record_resize(int bufid, int rows, int cols);
+
+int record_read_header(FILE *file);
+int record_read(FILE *file, struct record_event *event, char *data, int size);
+
+#endif
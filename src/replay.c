@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Replay a recording made with --record through the buffers, terminal
+ * emulation and controller exactly as if the slaves had output it. In real
+ * time the output is displayed as it originally was. Otherwise it is
+ * replayed as fast as possible to /dev/null, which turns a recorded session
+ * into a repeatable performance test.
+ *
+ * Only the output of the slaves is replayed. Recorded input is skipped and
+ * the first buffer in the recording is the one displayed.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "controller.h"
+#include "clock.h"
+#include "loop.h"
+#include "log.h"
+#include "util.h"
+#include "record.h"
+#include "replay.h"
+
+/*
+ * When replaying as fast as possible return to the loop after this many
+ * bytes so the controller output can drain.
+ */
+#define REPLAY_BATCH_BYTES (64 * 1024)
+
+static struct replay {
+	FILE *file;
+	bool realtime;
+
+	/* The next event to replay, read ahead to know when it is due */
+	bool pending;
+	struct record_event event;
+	char data[64 * 1024];
+
+	/* clock_now_us() time replay started and recorded time of the first event */
+	uint64_t start;
+	uint64_t first;
+
+	unsigned long bytes;
+	struct loop_timer timer;
+} replay;
+
+/*
+ * Read ahead the next event. At the end of the recording nothing is left
+ * pending.
+ */
+static void replay_read(void) {
+	int result;
+
+	result = record_read(replay.file, &replay.event, replay.data, sizeof(replay.data));
+	if (result == 0) {
+		replay.pending = true;
+		return;
+	}
+
+	if (result != ENOENT)
+		ELOG("Recording is corrupt, stopping replay");
+
+	replay.pending = false;
+}
+
+/*
+ * Report the throughput and stop the loop. Only called once the controller
+ * has written out everything replayed, so the time includes the drawing.
+ */
+static void replay_finish(void) {
+	uint64_t elapsed;
+
+	elapsed = clock_now_us() - replay.start;
+	NOTIFY("Replayed %lu bytes in %.3f seconds, %.1f MB/s", replay.bytes, elapsed / 1e6,
+	       elapsed ? replay.bytes / (elapsed / 1e6) / (1024 * 1024) : 0.0);
+	run = false;
+}
+
+static void replay_event(struct record_event *event, char *data) {
+	struct record_size size;
+	struct buffer *buffer;
+
+	switch (event->type) {
+		case RECORD_RESIZE:
+			if (event->len != sizeof(size))
+				break;
+
+			/* Existing buffers can't be resized */
+			memcpy(&size, data, sizeof(size));
+			if (!controller_replay_buffer(event->bufid, size.rows, size.cols))
+				ELOG("Unable to create replay buffer %d", event->bufid);
+			break;
+
+		case RECORD_OUTPUT:
+			buffer = controller_replay_buffer(event->bufid, 24, 80);
+			if (!buffer)
+				break;
+
+			buffer_input(buffer, event->len, data);
+			controller_enforce_memory_budget();
+			replay.bytes += event->len;
+			break;
+	}
+}
+
+/*
+ * Replay every event which is due. Output is held back until the controller
+ * has space for it, rather than being dropped.
+ */
+static void replay_timer(struct loop_timer *timer) {
+	uint64_t batch = 0;
+	uint64_t now = clock_now_us();
+
+	while (replay.pending) {
+		if (replay.realtime && replay.start + (replay.event.time - replay.first) > now)
+			break;
+
+		if (!replay.realtime && batch >= REPLAY_BATCH_BYTES)
+			break;
+
+		if (replay.event.type == RECORD_OUTPUT &&
+		    replay.event.len > controller_output_space())
+			break;
+
+		replay_event(&replay.event, replay.data);
+		batch += replay.event.len;
+		replay_read();
+	}
+
+	if (!replay.pending) {
+		/* Keep the loop running until the controller has drained */
+		if (controller_output_space() < CONTROLLER_BUF_SIZE)
+			timer->deadline = now;
+		else
+			replay_finish();
+		return;
+	}
+
+	if (replay.realtime)
+		timer->deadline = max(now, replay.start + (replay.event.time - replay.first));
+	else
+		timer->deadline = now;
+}
+
+/*
+ * Start replaying the given recording. The controller must not have been
+ * initialized.
+ *
+ * Returns:
+ * 0      - On success
+ * ENOENT - The recording couldn't be opened
+ * EINVAL - The file isn't a recording
+ * ENOMEM - Out of memory
+ */
+int replay_init(const char *path, bool realtime) {
+	int out_fd = STDOUT_FILENO;
+	int result;
+
+	replay.file = fopen(path, "rb");
+	if (!replay.file)
+		return ENOENT;
+
+	result = record_read_header(replay.file);
+	if (result)
+		goto out_close;
+
+	if (!realtime) {
+		out_fd = open("/dev/null", O_WRONLY);
+		if (out_fd < 0) {
+			result = ENOENT;
+			goto out_close;
+		}
+	}
+
+	result = controller_init_replay(out_fd);
+	if (result)
+		goto out_close;
+
+	replay.realtime = realtime;
+	replay.timer.timer_callback = replay_timer;
+	result = loop_register_timer(&replay.timer);
+	if (result)
+		goto out_close;
+
+	replay.start = clock_now_us();
+	replay_read();
+	replay.first = replay.event.time;
+	replay.timer.deadline = replay.start;
+
+	return 0;
+
+out_close:
+	fclose(replay.file);
+	return result;
+}
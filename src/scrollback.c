@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * The scroll buffer holds pointers to lines in fixed size chunks. A map of
+ * chunk pointers, with free space kept at both ends, allows lines to be
+ * added or removed at either end and any line to be reached with a single
+ * index calculation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "util.h"
+#include "alloc.h"
+#include "scrollback.h"
+
+#define MIN_CHUNKS 4
+
+void scrollback_init(struct scrollback *sb) {
+	memset(sb, 0, sizeof(*sb));
+}
+
+/*
+ * Free the scroll buffer bookkeeping. The lines themselves belong to the
+ * caller and must be freed before calling this.
+ */
+void scrollback_free(struct scrollback *sb) {
+	for (size_t i = 0; i < sb->num_chunks; i++)
+		alloc_free(ALLOC_SCROLLBACK, sb->chunks[i]);
+	alloc_free(ALLOC_SCROLLBACK, sb->chunks);
+	alloc_free(ALLOC_SCROLLBACK, sb->spare);
+
+	scrollback_init(sb);
+}
+
+static struct scrollback_chunk *scrollback_chunk_alloc(struct scrollback *sb) {
+	struct scrollback_chunk *chunk;
+
+	if (sb->spare) {
+		chunk = sb->spare;
+		sb->spare = NULL;
+		return chunk;
+	}
+
+	return alloc_malloc(ALLOC_SCROLLBACK, sizeof(*chunk));
+}
+
+static void scrollback_chunk_release(struct scrollback *sb, size_t index) {
+	if (sb->spare)
+		alloc_free(ALLOC_SCROLLBACK, sb->chunks[index]);
+	else
+		sb->spare = sb->chunks[index];
+
+	sb->chunks[index] = NULL;
+}
+
+/*
+ * Center the chunks in use in the chunk map so there is room to grow at
+ * both ends, doubling the size of the map first if it is over half full.
+ * A scroll buffer which has lines removed from the top as fast as they are
+ * added at the bottom only ever recenters, without allocating.
+ *
+ * Returns:
+ * 0      - On success
+ * ENOMEM - Unable to allocate the larger map
+ */
+static int scrollback_grow(struct scrollback *sb) {
+	struct scrollback_chunk **chunks;
+	size_t num_chunks;
+	size_t first = sb->start / SCROLLBACK_CHUNK_LINES;
+	size_t used = 0;
+	size_t offset;
+
+	if (sb->len > 0)
+		used = (sb->start + sb->len - 1) / SCROLLBACK_CHUNK_LINES - first + 1;
+
+	if (sb->num_chunks >= MIN_CHUNKS && used <= sb->num_chunks / 2) {
+		offset = (sb->num_chunks - used) / 2;
+
+		/* Unused chunk pointers are NULL, so swapping keeps them so */
+		if (offset < first) {
+			for (size_t i = 0; i < used; i++) {
+				sb->chunks[offset + i] = sb->chunks[first + i];
+				sb->chunks[first + i] = NULL;
+			}
+		} else if (offset > first) {
+			for (size_t i = used; i > 0; i--) {
+				sb->chunks[offset + i - 1] = sb->chunks[first + i - 1];
+				sb->chunks[first + i - 1] = NULL;
+			}
+		}
+	} else {
+		num_chunks = max(2 * sb->num_chunks, MIN_CHUNKS);
+		chunks = alloc_calloc(ALLOC_SCROLLBACK, num_chunks, sizeof(*chunks));
+		if (!chunks)
+			return ENOMEM;
+
+		offset = (num_chunks - used) / 2;
+		if (used > 0)
+			memcpy(&chunks[offset], &sb->chunks[first], used * sizeof(*chunks));
+
+		alloc_free(ALLOC_SCROLLBACK, sb->chunks);
+		sb->chunks = chunks;
+		sb->num_chunks = num_chunks;
+	}
+
+	sb->start = offset * SCROLLBACK_CHUNK_LINES + sb->start % SCROLLBACK_CHUNK_LINES;
+
+	return 0;
+}
+
+/*
+ * Append a line after the current bottom line.
+ *
+ * Returns:
+ * 0      - On success
+ * ENOMEM - Unable to allocate memory to hold the line
+ */
+int scrollback_push_back(struct scrollback *sb, struct vt_line *line) {
+	size_t pos = sb->start + sb->len;
+	size_t index = pos / SCROLLBACK_CHUNK_LINES;
+
+	if (index >= sb->num_chunks) {
+		if (scrollback_grow(sb))
+			return ENOMEM;
+
+		pos = sb->start + sb->len;
+		index = pos / SCROLLBACK_CHUNK_LINES;
+	}
+
+	if (!sb->chunks[index]) {
+		sb->chunks[index] = scrollback_chunk_alloc(sb);
+		if (!sb->chunks[index])
+			return ENOMEM;
+	}
+
+	sb->chunks[index]->lines[pos % SCROLLBACK_CHUNK_LINES] = line;
+	sb->len++;
+
+	return 0;
+}
+
+/*
+ * Insert a line before the current top line.
+ *
+ * Returns:
+ * 0      - On success
+ * ENOMEM - Unable to allocate memory to hold the line
+ */
+int scrollback_push_front(struct scrollback *sb, struct vt_line *line) {
+	size_t index;
+
+	if (sb->start == 0 && scrollback_grow(sb))
+		return ENOMEM;
+
+	index = (sb->start - 1) / SCROLLBACK_CHUNK_LINES;
+	if (!sb->chunks[index]) {
+		sb->chunks[index] = scrollback_chunk_alloc(sb);
+		if (!sb->chunks[index])
+			return ENOMEM;
+	}
+
+	sb->start--;
+	sb->chunks[index]->lines[sb->start % SCROLLBACK_CHUNK_LINES] = line;
+	sb->len++;
+
+	return 0;
+}
+
+/*
+ * Returns the bytes used to hold the lines, not counting the lines
+ * themselves.
+ */
+size_t scrollback_bytes(struct scrollback *sb) {
+	size_t chunks = 0;
+
+	if (sb->len > 0)
+		chunks = (sb->start + sb->len - 1) / SCROLLBACK_CHUNK_LINES -
+			 sb->start / SCROLLBACK_CHUNK_LINES + 1;
+	if (sb->spare)
+		chunks++;
+
+	return sb->num_chunks * sizeof(*sb->chunks) + chunks * sizeof(struct scrollback_chunk);
+}
+
+/*
+ * Remove the top line from the scroll buffer and return it, or NULL if the
+ * scroll buffer is empty.
+ */
+struct vt_line *scrollback_pop_front(struct scrollback *sb) {
+	struct vt_line *line;
+	size_t index;
+
+	if (sb->len == 0)
+		return NULL;
+
+	line = scrollback_get(sb, 0);
+	index = sb->start / SCROLLBACK_CHUNK_LINES;
+
+	sb->start++;
+	sb->len--;
+
+	if (sb->len == 0 || sb->start / SCROLLBACK_CHUNK_LINES != index)
+		scrollback_chunk_release(sb, index);
+
+	return line;
+}
+
+/*
+ * Remove the bottom line from the scroll buffer and return it, or NULL if
+ * the scroll buffer is empty.
+ */
+struct vt_line *scrollback_pop_back(struct scrollback *sb) {
+	struct vt_line *line;
+	size_t pos;
+
+	if (sb->len == 0)
+		return NULL;
+
+	pos = sb->start + sb->len - 1;
+	line = scrollback_get(sb, sb->len - 1);
+
+	sb->len--;
+
+	if (sb->len == 0 || pos % SCROLLBACK_CHUNK_LINES == 0)
+		scrollback_chunk_release(sb, pos / SCROLLBACK_CHUNK_LINES);
+
+	return line;
+}
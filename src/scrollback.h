@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Header for the scroll buffer, a chunked deque of lines which can be
+ * indexed in constant time from either end.
+ */
+#ifndef SCROLLBACK_H
+#define SCROLLBACK_H
+
+#include <stddef.h>
+
+struct vt_line;
+
+/*
+ * Number of lines held by each chunk. Must be a power of two.
+ */
+#define SCROLLBACK_CHUNK_LINES 256
+
+struct scrollback_chunk {
+	struct vt_line *lines[SCROLLBACK_CHUNK_LINES];
+};
+
+struct scrollback {
+	/* Map of chunks, only the chunks holding lines are allocated */
+	struct scrollback_chunk **chunks;
+	size_t num_chunks;
+
+	/* Position of the first line counted from the start of the map */
+	size_t start;
+	/* Number of lines held */
+	size_t len;
+
+	/* Most recently emptied chunk, kept to avoid allocating on the next push */
+	struct scrollback_chunk *spare;
+};
+
+void scrollback_init(struct scrollback *sb);
+void scrollback_free(struct scrollback *sb);
+int scrollback_push_back(struct scrollback *sb, struct vt_line *line);
+int scrollback_push_front(struct scrollback *sb, struct vt_line *line);
+struct vt_line *scrollback_pop_front(struct scrollback *sb);
+struct vt_line *scrollback_pop_back(struct scrollback *sb);
+size_t scrollback_bytes(struct scrollback *sb);
+
+/*
+ * Returns the n'th line from the top of the scroll buffer. n must be less
+ * than the number of lines held.
+ */
+static inline struct vt_line *scrollback_get(struct scrollback *sb, size_t n) {
+	size_t pos = sb->start + n;
+
+	return sb->chunks[pos / SCROLLBACK_CHUNK_LINES]->lines[pos % SCROLLBACK_CHUNK_LINES];
+}
+
+/*
+ * Returns the n'th line from the bottom of the scroll buffer.
+ */
+static inline struct vt_line *scrollback_get_last(struct scrollback *sb, size_t n) {
+	return scrollback_get(sb, sb->len - 1 - n);
+}
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Counters which aren't specific to any buffer. Buffers keep their own in
+ * struct buffer_stats.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "alloc.h"
+#include "stats.h"
+
+struct stats GStats;
+
+/*
+ * Print the global counters in a human readable form.
+ */
+void stats_print(FILE *file) {
+	fprintf(file, "loop iterations     %" PRIu64 "\n", GStats.loop_iterations);
+	fprintf(file, "loop wakeups        %" PRIu64 "\n", GStats.loop_wakeups);
+	fprintf(file, "timers fired        %" PRIu64 "\n", GStats.timers_fired);
+	fprintf(file, "signals             %" PRIu64 "\n", GStats.signals);
+	fprintf(file, "bytes typed         %" PRIu64 "\n", GStats.controller_bytes_read);
+	fprintf(file, "bytes displayed     %" PRIu64 "\n", GStats.controller_bytes_written);
+	fprintf(file, "bytes dropped       %" PRIu64 "\n", GStats.controller_bytes_dropped);
+	alloc_print(file);
+}
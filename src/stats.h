@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Counters kept by every part of tachyon while it runs, cheap enough to be
+ * always on. They can be shown with a meta key or dumped on SIGUSR1.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+/*
+ * Counters which aren't specific to any buffer.
+ */
+struct stats {
+	/* Times loop_run() polled */
+	uint64_t loop_iterations;
+	/* Polls which returned with an fd ready rather than a timeout */
+	uint64_t loop_wakeups;
+	/* Timers fired */
+	uint64_t timers_fired;
+	/* Signals handled */
+	uint64_t signals;
+	/* Bytes typed by the user */
+	uint64_t controller_bytes_read;
+	/* Bytes written to the controlling terminal */
+	uint64_t controller_bytes_written;
+	/* Bytes for the controlling terminal dropped because it was full */
+	uint64_t controller_bytes_dropped;
+};
+
+/*
+ * Counters kept by each buffer.
+ */
+struct buffer_stats {
+	/* Bytes read from the slave */
+	uint64_t bytes_read;
+	/* Bytes written to the slave */
+	uint64_t bytes_written;
+	/* Bytes for the slave dropped because its buffer was full */
+	uint64_t bytes_dropped;
+	/* Times the whole buffer was redrawn and the bytes it took */
+	uint64_t redraws;
+	uint64_t redraw_bytes;
+	/* Lines scrolled up or down */
+	uint64_t scrolls;
+	/* Lines allocated to grow the scroll buffer */
+	uint64_t lines_allocated;
+	/* Lines above the screen freed to keep the session within its memory budget */
+	uint64_t lines_evicted;
+	/* Microseconds from the slave being readable to its output being written to stdout */
+	struct histogram output_latency;
+	/* Microseconds from a key being readable on stdin to it being written to the slave */
+	struct histogram input_latency;
+};
+
+extern struct stats GStats;
+
+#define STATS_INC(counter) ((counter)++)
+#define STATS_ADD(counter, n) ((counter) += (n))
+
+void stats_print(FILE *file);
+
+#endif
@@ -34,6 +34,10 @@
 #include "buffer.h"
 #include "controller.h"
 #include "options.h"
+#include "profile.h"
+#include "record.h"
+#include "replay.h"
+#include "trace.h"
 
 /* Default values for the options are set here */
 struct cmd_options cmd_options = {
@@ -41,12 +45,24 @@ struct cmd_options cmd_options = {
 	.verbose = 1,
 	.new_buf_command = "",
 	.session_name = "",
+	.profile_path = "",
+	.record_path = "",
+	.record_input = false,
+	.replay_path = "",
+	.replay_realtime = false,
+	.stats_path = "",
+	.trace_path = "",
+	.log_path = "",
+	.scrollback_lines = 0,
+	.memory_budget = 0,
 	.keys = {
 		.meta= 't',
 		.buffer_create = 'c',
 		.buffer_next = 'n',
 		.buffer_prev = 'p',
 		.buffer_last = CONTROL('t'),
+		.stats = 's',
+		.memory = 'm',
 		.buffer_0 = '0',
 		.buffer_1 = '1',
 		.buffer_2 = '2',
@@ -67,17 +83,38 @@ const static struct option parameters[] = {
 	{"verbose" , no_argument       , NULL , 'v'}  , 
 	{"quiet"   , no_argument       , NULL , 'q'}  , 
 	{"name"    , required_argument , NULL , 'n'}  , 
+	{"profile" , required_argument , NULL , 'P'}  , 
+	{"record"  , required_argument , NULL , 'r'}  , 
+	{"record-input", no_argument   , NULL , 'i'}  , 
+	{"replay"  , required_argument , NULL , 'R'}  , 
+	{"realtime", no_argument       , NULL , 'T'}  , 
+	{"stats"   , required_argument , NULL , 'S'}  , 
+	{"trace"   , required_argument , NULL , 't'}  , 
+	{"log"     , required_argument , NULL , 'l'}  , 
+	{"scrollback", required_argument, NULL , 'b'}  , 
+	{"memory-budget", required_argument, NULL , 'M'}  , 
 	{NULL      , no_argument       , NULL , 0 }};
 
-#define SHORTARGS "hpqs:vn:"
+#define SHORTARGS "hpqs:vn:P:r:iR:TS:t:l:b:M:"
 static void usage(void) {
-	printf("tachyon [-hHpqv] [-s shell] [-n name]\n");
+	printf("tachyon [-hHpqviT] [-s shell] [-n name] [-P file] [-r file] [-R file] [-S file] [-t file] [-l file] [-b lines] [-M KiB]\n");
 	printf("	-h --help              - Display this message\n");
 	printf("	-p --predictor         - Turn on character prediction\n");
 	printf("	-v --verbose           - increase log level (multiple allowed)\n");
 	printf("	-s shell --shell=shell - command to run as shell for new buffer\n");
 	printf("	-q --quiet             - decrease log level (multiple allowed)\n");
 	printf("        -n --name              - Name to use for this session\n");
+	printf("	-P file --profile=file - File to keep prediction profiles in\n");
+	printf("	-r file --record=file  - Record the output of every buffer to file\n");
+	printf("	-i --record-input      - Also record what is typed, including passwords\n");
+	printf("	-R file --replay=file  - Replay a recording headless as fast as possible\n");
+	printf("	-T --realtime          - Display the replay in real time instead\n");
+	printf("	-S file --stats=file   - File to dump the stats to on SIGUSR1\n");
+	printf("	-t file --trace=file   - Trace events, dumping them to file on SIGUSR2 and exit\n");
+	printf("	-l file --log=file     - Log to file instead of stderr\n");
+	printf("	-b lines --scrollback=lines - Lines kept above the screen, 0 for unlimited\n");
+	printf("	-M KiB --memory-budget=KiB - Free the oldest scrollback of the least recently\n");
+	printf("	                         viewed buffers to stay within KiB, 0 for unlimited\n");
 }
 
 /*
@@ -105,12 +142,58 @@ static int process_args(int argn, char **args) {
 
 			case 's':
 				strncpy(cmd_options.new_buf_command, optarg,
-					sizeof(cmd_options.new_buf_command));
+					sizeof(cmd_options.new_buf_command) - 1);
 				break;
 
 			case 'n':
 				strncpy(cmd_options.session_name, optarg,
-					sizeof(cmd_options.session_name));
+					sizeof(cmd_options.session_name) - 1);
+				break;
+
+			case 'P':
+				strncpy(cmd_options.profile_path, optarg,
+					sizeof(cmd_options.profile_path) - 1);
+				break;
+
+			case 'r':
+				strncpy(cmd_options.record_path, optarg,
+					sizeof(cmd_options.record_path) - 1);
+				break;
+
+			case 'i':
+				cmd_options.record_input = true;
+				break;
+
+			case 'R':
+				strncpy(cmd_options.replay_path, optarg,
+					sizeof(cmd_options.replay_path) - 1);
+				break;
+
+			case 'T':
+				cmd_options.replay_realtime = true;
+				break;
+
+			case 'S':
+				strncpy(cmd_options.stats_path, optarg,
+					sizeof(cmd_options.stats_path) - 1);
+				break;
+
+			case 't':
+				strncpy(cmd_options.trace_path, optarg,
+					sizeof(cmd_options.trace_path) - 1);
+				break;
+
+			case 'l':
+				strncpy(cmd_options.log_path, optarg,
+					sizeof(cmd_options.log_path) - 1);
+				break;
+
+			case 'b':
+				cmd_options.scrollback_lines = atoi(optarg);
+				break;
+
+			case 'M':
+				cmd_options.memory_budget = atol(optarg);
 				break;
 
 			case 'h':
@@ -188,6 +271,73 @@ static int set_defaults(void) {
 	}
 	DLOG("Session name is '%s'", cmd_options.session_name);
 
+	if (cmd_options.profile_path[0] == '\0' && getenv("HOME")) {
+		snprintf(cmd_options.profile_path, sizeof(cmd_options.profile_path) - 1,
+			 "%s/.tachyon_profile", getenv("HOME"));
+	}
+	DLOG("Profile path is '%s'", cmd_options.profile_path);
+
+	/* Somewhere only this user can write, so the dump can't be redirected */
+	if (cmd_options.stats_path[0] == '\0' && getenv("XDG_RUNTIME_DIR")) {
+		snprintf(cmd_options.stats_path, sizeof(cmd_options.stats_path) - 1, "%s/%s.stats",
+			 getenv("XDG_RUNTIME_DIR"), cmd_options.session_name);
+	} else if (cmd_options.stats_path[0] == '\0' && getenv("HOME")) {
+		snprintf(cmd_options.stats_path, sizeof(cmd_options.stats_path) - 1, "%s/.%s.stats",
+			 getenv("HOME"), cmd_options.session_name);
+	}
+	DLOG("Stats path is '%s'", cmd_options.stats_path);
+
+	return 0;
+}
+
+/*
+ * Keep what was learnt about the programs run this session for next time.
+ */
+static void save_profiles(void) {
+	int result;
+
+	result = profile_save(cmd_options.profile_path);
+	if (result)
+		ELOG("Unable to save prediction profiles to '%s': %d", cmd_options.profile_path, result);
+}
+
+/*
+ * Start tracing if a file to dump the trace to was given.
+ */
+static void start_trace(void) {
+	int result;
+
+	if (cmd_options.trace_path[0] == '\0')
+		return;
+
+	result = trace_init(cmd_options.trace_path);
+	if (result)
+		ELOG("Unable to trace to '%s': %d", cmd_options.trace_path, result);
+}
+
+/*
+ * Replay a recording instead of running slaves. The controlling terminal is
+ * left alone since there is no input.
+ */
+static int run_replay(void) {
+	int result;
+
+	result = loop_init();
+	DLOG("loop_init %d", result);
+
+	start_trace();
+
+	result = replay_init(cmd_options.replay_path, cmd_options.replay_realtime);
+	if (result) {
+		ELOG("Unable to replay '%s': %d", cmd_options.replay_path, result);
+		return 1;
+	}
+
+	while (run) {
+		if (!loop_run())
+			ELOG("Running the loop failed");
+	}
+
 	return 0;
 }
 
@@ -198,9 +348,35 @@ int main(int argn, char **args) {
 	if (result)
 		return result - 1;
 
+	if (cmd_options.log_path[0] != '\0') {
+		result = log_open(cmd_options.log_path);
+		if (result) {
+			ELOG("Unable to log to '%s': %d", cmd_options.log_path, result);
+			return 1;
+		}
+	}
+
 	if (set_defaults())
 		return 1;
 
+	if (cmd_options.replay_path[0] != '\0')
+		return run_replay();
+
+	if (cmd_options.predict && cmd_options.profile_path[0] != '\0') {
+		result = profile_load(cmd_options.profile_path);
+		DLOG("profile_load %d", result);
+		atexit(save_profiles);
+	}
+
+	if (cmd_options.record_path[0] != '\0') {
+		result = record_open(cmd_options.record_path, cmd_options.record_input);
+		if (result) {
+			ELOG("Unable to record to '%s': %d", cmd_options.record_path, result);
+			return 1;
+		}
+		atexit(record_close);
+	}
+
 	tty_save_termstate();
 	result = tty_configure_control_tty();
 	DLOG("tty_configure_control_tty %d %d", result, errno);
@@ -208,6 +384,8 @@ int main(int argn, char **args) {
 	result = loop_init();
 	DLOG("loop_init %d", result);
 
+	start_trace();
+
 	result = controller_init();
 	DLOG("register out %d", result);
 
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * The trace ring. Events are claimed with an atomic increment of the ring
+ * index so they may be recorded from anywhere, including signal handlers,
+ * without a lock. Recording costs a clock read and a 16 byte store.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "log.h"
+#include "loop.h"
+#include "clock.h"
+#include "trace.h"
+
+bool trace_enabled;
+
+static struct trace_event ring[TRACE_RING_EVENTS];
+
+/* Total events ever recorded, the next goes in ring[index % size] */
+static uint32_t ring_index;
+
+static char dump_path[1024];
+
+void trace_record(enum trace_id id, int bufid, uint32_t arg) {
+	uint32_t i = __atomic_fetch_add(&ring_index, 1, __ATOMIC_RELAXED);
+	struct trace_event *event = &ring[i & (TRACE_RING_EVENTS - 1)];
+
+	event->time = clock_now_us();
+	event->id = id;
+	event->bufid = bufid;
+	event->reserved = 0;
+	event->arg = arg;
+}
+
+/*
+ * Write the events in the ring to the given file, oldest first.
+ *
+ * Returns:
+ * 0      - On success
+ * EIO    - Unable to write the file
+ * Or any errno from fopen()
+ */
+int trace_dump(const char *path) {
+	uint32_t end = __atomic_load_n(&ring_index, __ATOMIC_RELAXED);
+	uint32_t count = end < TRACE_RING_EVENTS ? end : TRACE_RING_EVENTS;
+	uint32_t first = end - count;
+	uint32_t i;
+	FILE *file;
+	int result = 0;
+
+	file = fopen(path, "wb");
+	if (!file)
+		return errno;
+
+	if (fwrite(TRACE_MAGIC, strlen(TRACE_MAGIC), 1, file) != 1 ||
+	    fwrite(&count, sizeof(count), 1, file) != 1)
+		result = EIO;
+
+	for (i = first; !result && i != end; i++)
+		if (fwrite(&ring[i & (TRACE_RING_EVENTS - 1)], sizeof(*ring), 1, file) != 1)
+			result = EIO;
+
+	if (fclose(file) && !result)
+		result = EIO;
+
+	return result;
+}
+
+static void trace_handle_sigusr2(siginfo_t *siginfo, int num_signals) {
+	int result;
+
+	result = trace_dump(dump_path);
+	if (result)
+		WLOG("Unable to dump trace to '%s': %d", dump_path, result);
+	else
+		DLOG("Dumped trace to '%s'", dump_path);
+}
+
+static void trace_dump_at_exit(void) {
+	trace_handle_sigusr2(NULL, 0);
+}
+
+/*
+ * Start tracing, dumping the ring to the given file on SIGUSR2 and at exit.
+ * Must be called after loop_init().
+ *
+ * Returns:
+ * 0      - On success
+ * EINVAL - The path is too long
+ */
+int trace_init(const char *path) {
+	if (strlen(path) >= sizeof(dump_path))
+		return EINVAL;
+
+	strcpy(dump_path, path);
+	trace_enabled = true;
+
+	loop_register_signal(SIGUSR2, trace_handle_sigusr2);
+	atexit(trace_dump_at_exit);
+
+	return 0;
+}
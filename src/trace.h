@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Header for the trace ring, a record of the recent timeline of tachyon in
+ * compact binary events which can be dumped and converted to the Chrome
+ * trace format.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRACE_MAGIC "TACHTRC1"
+
+/*
+ * Number of events kept, the oldest are overwritten. Must be a power of two.
+ */
+#define TRACE_RING_EVENTS (64 * 1024)
+
+/*
+ * Every event: its id, name and Chrome trace phase. Events with phase B
+ * begin a span which the following E event ends, i events are instants.
+ */
+#define TRACE_EVENTS(X) \
+	X(TRACE_POLL_ENTER,       "poll",             'B') \
+	X(TRACE_POLL_EXIT,        "poll",             'E') \
+	X(TRACE_PTY_READ,         "pty read",         'i') \
+	X(TRACE_VT_PARSE_BEGIN,   "vt parse",         'B') \
+	X(TRACE_VT_PARSE_END,     "vt parse",         'E') \
+	X(TRACE_REDRAW_BEGIN,     "redraw",           'B') \
+	X(TRACE_REDRAW_END,       "redraw",           'E') \
+	X(TRACE_FLUSH_BEGIN,      "controller flush", 'B') \
+	X(TRACE_FLUSH_END,        "controller flush", 'E') \
+	X(TRACE_PREDICT,          "predict",          'i') \
+	X(TRACE_PREDICT_BLOCKED,  "predict blocked",  'i') \
+	X(TRACE_PREDICT_CONFIRM,  "predict confirm",  'i') \
+	X(TRACE_PREDICT_MISS,     "predict miss",     'i')
+
+#define TRACE_ENUM(id, name, phase) id,
+enum trace_id {
+	TRACE_EVENTS(TRACE_ENUM)
+	TRACE_MAX
+};
+#undef TRACE_ENUM
+
+/*
+ * A single event as kept in the ring and written to the dump. The dump is
+ * TRACE_MAGIC followed by a uint32_t count of events, oldest first.
+ */
+struct trace_event {
+	uint64_t time; /* clock_now_us() */
+	uint16_t id;
+	uint8_t bufid; /* 0xff when the event isn't for a buffer */
+	uint8_t reserved;
+	uint32_t arg; /* Event specific, usually a byte count */
+};
+
+#define TRACE_NO_BUFFER 0xff
+
+extern bool trace_enabled;
+
+void trace_record(enum trace_id id, int bufid, uint32_t arg);
+
+/*
+ * Record an event if tracing is on. Cheap enough to leave in hot paths.
+ */
+#define TRACE(id, bufid, arg) do { \
+	if (trace_enabled)         \
+		trace_record(id, bufid, arg); \
+} while (0)
+
+int trace_init(const char *path);
+int trace_dump(const char *path);
+
+#endif
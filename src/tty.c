@@ -236,3 +236,27 @@ struct winsize tty_get_winsize(int fd) {
 
 	return size;
 }
+
+/*
+ * Determine from the line discipline of the slave whether input written to
+ * the given pty master may be echoed back. Reading a line with echo turned
+ * off, such as at a password prompt, is the only state known not to echo.
+ * Programs reading raw input, including shells using readline, turn off
+ * the line discipline echo but echo for themselves.
+ */
+bool tty_may_echo(int fd) {
+	struct termios termstate;
+
+	if (tcgetattr(fd, &termstate))
+		return true;
+
+	return (termstate.c_lflag & ECHO) || !(termstate.c_lflag & ICANON);
+}
+
+/*
+ * Returns the process group in the foreground of the slave of the given pty
+ * master, or -1 if it can't be determined.
+ */
+pid_t tty_foreground(int fd) {
+	return tcgetpgrp(fd);
+}
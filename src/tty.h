@@ -1,11 +1,16 @@
 #ifndef TTY_H
 #define TTY_H
 
+#include <stdbool.h>
+#include <sys/types.h>
+
 int tty_new(char *command, int bufnum);
 void tty_save_termstate(void);
 void tty_restore_termstate(void);
 int tty_configure_control_tty(void);
 int tty_set_winsize(int fd, int rows, int cols);
 struct winsize tty_get_winsize(int fd);
+bool tty_may_echo(int fd);
+pid_t tty_foreground(int fd);
 
 #endif
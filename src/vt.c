@@ -26,6 +26,7 @@
 #include "options.h"
 #include "buffer.h"
 #include "util.h"
+#include "alloc.h"
 #include "vt.h"
 
 #define DEFAULT(func) \
@@ -49,37 +50,72 @@ struct terminal_def {
 	mode_fn modes[];
 };
 
-static void vt_line_init(struct vt_line *line, struct vt_line *prev,
-			     struct vt_line *next) {
-	line->next = next;
-	line->prev = prev;
+static void vt_line_free(struct vt_line *line) {
+	alloc_free(ALLOC_VT, line);
 }
 
-static void vt_line_free(struct vt_line *line) {
-	free(line);
+/*
+ * Blank the cells in [start, end) of the line. Erasing through the end of
+ * the line only lowers the blank watermark, the cells themselves are left
+ * alone until vt_get_cell() needs them again.
+ */
+static void vt_line_erase(struct vt_line *line, int start, int end) {
+	end = min(end, line->len);
+	if (start >= end)
+		return;
+
+	if (end >= line->blank_from) {
+		line->blank_from = min(line->blank_from, start);
+		return;
+	}
+
+	memset(&line->cells[start], 0, (end - start) * sizeof(*line->cells));
 }
 
-static void vt_cell_init(struct vt_cell *cell) {
-	memset(cell, 0, sizeof(*cell));
+static void vt_line_clear(struct vt_line *line) {
+	line->blank_from = 0;
 }
 
 static struct vt_line *vt_line_alloc(int columns) {
 	struct vt_line *line;
 
-	line = malloc(sizeof(*line) + columns*sizeof(*line->cells));
+	line = alloc_malloc(ALLOC_VT, sizeof(*line) + columns*sizeof(*line->cells));
 	if (!line)
 		return NULL;
 
-	line->next = NULL;
-	line->prev = NULL;
 	line->len = columns;
-
-	for (int i = 0; i < columns; i++)
-		vt_cell_init(&line->cells[i]);
+	line->blank_from = 0;
 
 	return line;
 }
 
+/*
+ * Returns the bytes held by each line of the emulation.
+ */
+size_t vt_line_bytes(struct vt *vt) {
+	return sizeof(struct vt_line) + vt->cols * sizeof(struct vt_cell);
+}
+
+/*
+ * Free up to the given number of the oldest lines above the screen. The
+ * lines on the screen and any below it are never freed.
+ *
+ * Returns the number of lines freed.
+ */
+size_t vt_evict_scrollback(struct buffer *buffer, size_t lines) {
+	struct vt *vt = &buffer->vt;
+	size_t i;
+
+	for (i = 0; i < lines && vt->view > 0; i++) {
+		vt_line_free(scrollback_pop_front(&vt->scrollback));
+		vt->view--;
+	}
+
+	STATS_ADD(buffer->stats.lines_evicted, i);
+
+	return i;
+}
+
 /*
  * Initial state of the program modifiable state
  */
@@ -113,50 +149,61 @@ int vt_init(struct vt *vt, int rows, int cols) {
 	vt->cols = cols;
 	vt_reset_state(vt);
 
-	vt->lines = malloc(vt->cols * sizeof(*vt->lines));
-	if (!vt->lines)
+	scrollback_init(&vt->scrollback);
+	vt->view = 0;
+
+	vt->primary = alloc_calloc(ALLOC_VT, vt->rows, sizeof(*vt->primary));
+	if (!vt->primary)
 		goto err;
 
+	vt->alternate = alloc_calloc(ALLOC_VT, vt->rows, sizeof(*vt->alternate));
+	if (!vt->alternate)
+		goto err_free_lines;
+
 	for (int i = 0; i < vt->rows; i++) {
-		vt->lines[i] = vt_line_alloc(vt->cols);
-		if (!vt->lines[i])
+		vt->primary[i] = vt_line_alloc(vt->cols);
+		if (!vt->primary[i])
 			goto err_free_lines;
-	}
-	vt->topmost = vt->lines[0];
-	vt->bottommost = vt->lines[vt->rows - 1];
 
-	vt_line_init(vt->topmost, NULL, vt->lines[1]);
-	for (int i = 1; i < vt->rows - 1; i++)
-		vt_line_init(vt->lines[i], vt->lines[i - 1], vt->lines[i + 1]);
-	vt_line_init(vt->bottommost, vt->lines[vt->cols - 2], NULL);
+		if (scrollback_push_back(&vt->scrollback, vt->primary[i])) {
+			vt_line_free(vt->primary[i]);
+			goto err_free_lines;
+		}
+
+		vt->alternate[i] = vt_line_alloc(vt->cols);
+		if (!vt->alternate[i])
+			goto err_free_lines;
+	}
+	vt->lines = vt->primary;
 
 	return 0;
 
 err_free_lines:
-	if (vt->lines) {
-		for (int i = 0; i < vt->cols; i++)
-			free(vt->lines[i]);
+	while (vt->scrollback.len > 0)
+		vt_line_free(scrollback_pop_front(&vt->scrollback));
+	scrollback_free(&vt->scrollback);
+
+	if (vt->alternate) {
+		for (int i = 0; i < vt->rows; i++)
+			vt_line_free(vt->alternate[i]);
 	}
-	free(vt->lines);
+	alloc_free(ALLOC_VT, vt->alternate);
+	alloc_free(ALLOC_VT, vt->primary);
 
 err:
 	return ENOMEM;
 }
 
 void vt_free(struct vt *vt) {
-	struct vt_line *current;
-	struct vt_line *next = NULL;
+	for (size_t i = 0; i < vt->scrollback.len; i++)
+		vt_line_free(scrollback_get(&vt->scrollback, i));
+	scrollback_free(&vt->scrollback);
 
-	current = vt->topmost;
-	if (current)
-		next = current->next;
-	while (current) {
-		vt_line_free(current);
+	for (int i = 0; i < vt->rows; i++)
+		vt_line_free(vt->alternate[i]);
 
-		current = next;
-		if (next)
-			next = next->next;
-	}
+	alloc_free(ALLOC_VT, vt->alternate);
+	alloc_free(ALLOC_VT, vt->primary);
 }
 
 struct vt_cell *vt_get_cell(struct buffer *buf, unsigned int row, unsigned int col) {
@@ -170,6 +217,13 @@ struct vt_cell *vt_get_cell(struct buffer *buf, unsigned int row, unsigned int c
 	if (col >= line->len)
 		return NULL;
 
+	if (col >= line->blank_from) {
+		/* Materialize the lazily blanked cells up to this one */
+		memset(&line->cells[line->blank_from], 0,
+		       (col + 1 - line->blank_from) * sizeof(*line->cells));
+		line->blank_from = col + 1;
+	}
+
 	return &line->cells[col];
 }
 
@@ -178,25 +232,46 @@ static void vt_scroll_up(struct buffer *buffer) {
 	struct vt_line *line;
 	bool need_redraw = true;
 
-	line = vt->lines[vt->rows - 1]->next;
-	if (!line) {
+	if (vt->lines == vt->alternate) {
+		/* The alternate screen has no scroll buffer, reuse the top line */
+		line = vt->lines[0];
+		vt_line_clear(line);
+
+		need_redraw = false;
+	} else if (vt->view + vt->rows < vt->scrollback.len) {
+		line = scrollback_get(&vt->scrollback, vt->view + vt->rows);
+		vt->view++;
+	} else if (cmd_options.scrollback_lines > 0 && vt->view >= cmd_options.scrollback_lines) {
+		/* The scroll buffer is full, reuse the oldest line at the bottom */
+		line = scrollback_pop_front(&vt->scrollback);
+		vt_line_clear(line);
+		if (scrollback_push_back(&vt->scrollback, line)) {
+			ELOG("Failed to reuse line!");
+			vt_line_free(line);
+			vt->view--;
+			return;
+		}
+
+		need_redraw = false;
+	} else {
 		/* No lines below in the scrollback, create a new one */
 		line = vt_line_alloc(vt->cols);
-		if (!line) {
+		if (!line || scrollback_push_back(&vt->scrollback, line)) {
 			ELOG("Failed to allocate new line!");
+			vt_line_free(line);
 			return;
 		}
-
-		vt_line_init(line, vt->bottommost, NULL);
-		vt->bottommost->next = line;
+		STATS_INC(buffer->stats.lines_allocated);
+		vt->view++;
 
 		need_redraw = false;
 	}
 
+	STATS_INC(buffer->stats.scrolls);
+
 	memmove(&vt->lines[0], &vt->lines[1],
 		(vt->rows - 1) * sizeof(*vt->lines));
 	vt->lines[vt->rows - 1] = line;
-	vt->bottommost = line;
 
 	/* Ensure that the newly visible line is displayed to the user */
 	if (need_redraw)
@@ -208,31 +283,68 @@ static void vt_scroll_down(struct buffer *buffer) {
 	struct vt_line *line;
 	bool need_redraw = true;
 
-	line = vt->lines[0]->prev;
-	if (!line) {
+	if (vt->lines == vt->alternate) {
+		/* The alternate screen has no scroll buffer, reuse the bottom line */
+		line = vt->lines[vt->rows - 1];
+		vt_line_clear(line);
+
+		need_redraw = false;
+	} else if (vt->view > 0) {
+		vt->view--;
+		line = scrollback_get(&vt->scrollback, vt->view);
+	} else if (cmd_options.scrollback_lines > 0 &&
+		   vt->scrollback.len - vt->rows >= cmd_options.scrollback_lines) {
+		/* The scroll buffer is full, reuse the furthest line below the screen */
+		line = scrollback_pop_back(&vt->scrollback);
+		vt_line_clear(line);
+		if (scrollback_push_front(&vt->scrollback, line)) {
+			ELOG("Failed to reuse line!");
+			vt_line_free(line);
+			return;
+		}
+
+		need_redraw = false;
+	} else {
 		/* At the top of the scroll back, create a new line and insert it */
 		line = vt_line_alloc(vt->cols);
-		if (!line) {
+		if (!line || scrollback_push_front(&vt->scrollback, line)) {
 			ELOG("Failed to allocate new line!");
+			vt_line_free(line);
 			return;
 		}
-
-		vt_line_init(line, NULL, vt->lines[0]);
-		vt->topmost->prev = line;
+		STATS_INC(buffer->stats.lines_allocated);
 
 		need_redraw = false;
 	}
 
+	STATS_INC(buffer->stats.scrolls);
+
 	memmove(&vt->lines[1], &vt->lines[0],
 		(vt->rows - 1) * sizeof(*vt->lines));
 	vt->lines[0] = line;
-	vt->topmost = line;
 
 	/* Ensure that the newly visible line is displayed to the user */
 	if (need_redraw)
 		buffer_redraw(buffer);
 }
 
+/*
+ * Switch between the primary screen and the preallocated alternate screen.
+ * Only the line view is swapped, so entering and leaving the alternate
+ * screen never touches the scroll buffer.
+ */
+static void vt_use_alternate_screen(struct vt *vt, bool alternate) {
+	if (alternate)
+		vt->lines = vt->alternate;
+	else
+		vt->lines = vt->primary;
+}
+
+static void vt_clear_alternate_screen(struct vt *vt) {
+	for (int i = 0; i < vt->rows; i++)
+		vt_line_clear(vt->alternate[i]);
+}
+
 static void ignore(struct buffer *buffer, struct vt_cell *cell, char c) {}
 
 static void normal_chars(struct buffer *buffer, struct vt_cell *cell, char c) {
@@ -391,6 +503,7 @@ static void escape_osc(struct buffer *buffer, struct vt_cell *cell, char c) {
 static void escape_reset_to_initial(struct buffer *buffer, struct vt_cell *cell, char c) {
 	struct vt *vt = &buffer->vt;
 	vt_reset_state(vt);
+	vt_use_alternate_screen(vt, false);
 
 	vt->vt_mode = MODE_NORMAL;
 }
@@ -422,41 +535,18 @@ static void csi_clear_screen(struct buffer *buffer, struct vt_cell *cell, char c
 
 	if (vt->params.len == 0 || CONST_STR_IS("0", vt->params.chars)) {
 		/* Clear from cursor to end of screen */
-		for (int col = vt->current.col; col < vt->cols; col++) {
-			cell = vt_get_cell(buffer, vt->current.row, col);
-			if (cell)
-				cell->flags &= ~VT_FLAG_CELL_SET;
-		}
-		for (int row = vt->current.row + 1; row < vt->rows; row++) {
-			for (int col = 0; col < vt->cols; col++) {
-				cell = vt_get_cell(buffer, row, col);
-				if (cell)
-					cell->flags &= ~VT_FLAG_CELL_SET;
-			}
-		}
+		vt_line_erase(vt->lines[vt->current.row], vt->current.col, vt->cols);
+		for (int row = vt->current.row + 1; row < vt->rows; row++)
+			vt_line_clear(vt->lines[row]);
 	} else if (vt->params.len > 0 && CONST_STR_IS("1", vt->params.chars)) {
 		/* Clear screen from 0,0 for cursor */
-		for (int row = 0; row < vt->current.row; row++) {
-			for (int col = 0; col < vt->cols; col++) {
-				cell = vt_get_cell(buffer, row, col);
-				if (cell)
-					cell->flags &= ~VT_FLAG_CELL_SET;
-			}
-		}
-		for (int col = 0; col <= vt->current.col; col++) {
-			cell = vt_get_cell(buffer, vt->current.row, col);
-			if (cell)
-				cell->flags &= ~VT_FLAG_CELL_SET;
-		}
+		for (int row = 0; row < vt->current.row; row++)
+			vt_line_clear(vt->lines[row]);
+		vt_line_erase(vt->lines[vt->current.row], 0, vt->current.col + 1);
 	} else if (vt->params.len > 0 && CONST_STR_IS("2", vt->params.chars)) {
 		/* Clear entire screen */
-		for (int row = 0; row < vt->rows; row++) {
-			for (int col = 0; col < vt->cols; col++) {
-				cell = vt_get_cell(buffer, row, col);
-				if (cell)
-					cell->flags &= ~VT_FLAG_CELL_SET;
-			}
-		}
+		for (int row = 0; row < vt->rows; row++)
+			vt_line_clear(vt->lines[row]);
 	} else {
 		/* Any other mode is an error. Do nothing */
 		DLOG("Unsupported csi_clear_screen type '%s'", vt->params.chars);
@@ -467,35 +557,21 @@ static void csi_clear_screen(struct buffer *buffer, struct vt_cell *cell, char c
 
 static void csi_position_cursor(struct buffer *buffer, struct vt_cell *cell, char c) {
 	struct vt *vt = &buffer->vt;
-	int row;
-	int col;
-	int result;
+	long row;
+	long col = 1;
+	char *end;
 
-	if (vt->params.len == 0 ||
-	     (vt->params.len == 1 && CONST_STR_IS(";", vt->params.chars))) {
-		row = 0;
-		col = 0;
-		result = 2; /* Match successful sscanf below */
-	}
-
-	if (vt->params.len >= 3) {
-		result = sscanf(vt->params.chars, "%u;%u", &row, &col);
-		if (result == 2) {
-			/*
-			 * The command is 1-indexed with 0 and 1 aliased where
-			 * we are 0-indexed, convert.
-			 * */
-			if (row != 0)
-				row--;
-			if (col != 0)
-				col--;
-		}
-	}
+	/*
+	 * The command is 1-indexed where we are 0-indexed. Missing, zero and
+	 * negative parameters all mean 1, and anything past the edge of the
+	 * screen is pinned to that edge.
+	 */
+	row = strtol(vt->params.chars, &end, 10);
+	if (*end == ';')
+		col = strtol(end + 1, NULL, 10);
 
-	if (result == 2) {
-		vt->current.row = row;
-		vt->current.col = col;
-	}
+	vt->current.row = min(max(row, 1), vt->rows) - 1;
+	vt->current.col = min(max(col, 1), vt->cols) - 1;
 
 	vt->vt_mode = MODE_NORMAL;
 }
@@ -590,28 +666,17 @@ static void csi_move_cursor_right(struct buffer *buffer, struct vt_cell *cell, c
 
 static void csi_clear_line(struct buffer *buffer, struct vt_cell *cell, char c) {
 	struct vt *vt = &buffer->vt;
+	struct vt_line *line = vt->lines[vt->current.row];
 
 	if (vt->params.len == 0 || CONST_STR_IS("0", vt->params.chars)) {
 		/* Clear from cursor to end of line */
-		for (int col = vt->current.col; col < vt->cols; col++) {
-			cell = vt_get_cell(buffer, vt->current.row, col);
-			if (cell)
-				cell->flags &= ~VT_FLAG_CELL_SET;
-		}
+		vt_line_erase(line, vt->current.col, vt->cols);
 	} else if (vt->params.len > 0 && CONST_STR_IS("1", vt->params.chars)) {
 		/* Clear from start of line to cursor */
-		for (int col = 0; col <= vt->current.col; col++) {
-			cell = vt_get_cell(buffer, vt->current.row, col);
-			if (cell)
-				cell->flags &= ~VT_FLAG_CELL_SET;
-		}
+		vt_line_erase(line, 0, vt->current.col + 1);
 	} else if (vt->params.len > 0 && CONST_STR_IS("2", vt->params.chars)) {
 		/* Clear entire line */
-		for (int col = 0; col < vt->cols; col++) {
-			cell = vt_get_cell(buffer, vt->current.row, col);
-			if (cell)
-				cell->flags &= ~VT_FLAG_CELL_SET;
-		}
+		vt_line_clear(line);
 	} else {
 		/* Any other mode is an error. Do nothing */
 		DLOG("Unsupported csi_clear_line type '%s'", vt->params.chars);
@@ -634,7 +699,27 @@ static void csi_tabstop_clear(struct buffer *buffer, struct vt_cell *cell, char
 }
 
 static void decode_mode(struct vt *vt, char *mode, bool val) {
-	DLOG("Unsupported mode '%s'", mode);
+	if (CONST_STR_IS("?47", mode)) {
+		/* Switch to or from the alternate screen */
+		vt_use_alternate_screen(vt, val);
+	} else if (CONST_STR_IS("?1047", mode)) {
+		/* Switch to the alternate screen, clearing it when leaving */
+		if (!val)
+			vt_clear_alternate_screen(vt);
+		vt_use_alternate_screen(vt, val);
+	} else if (CONST_STR_IS("?1049", mode)) {
+		/* Save the cursor and switch to a clear alternate screen */
+		if (val) {
+			vt->saved = vt->current;
+			vt_use_alternate_screen(vt, true);
+			vt_clear_alternate_screen(vt);
+		} else {
+			vt_use_alternate_screen(vt, false);
+			vt->current = vt->saved;
+		}
+	} else {
+		DLOG("Unsupported mode '%s'", mode);
+	}
 }
 
 static void parse_mode(struct vt *vt, bool val) {
@@ -646,6 +731,7 @@ static void parse_mode(struct vt *vt, bool val) {
 	cur = vt->params.chars;
 
 	while (cur < end) {
+		next = cur;
 		while (next < end && *next != ';')
 			next++;
 		if (next < end) {
@@ -22,6 +22,7 @@
 
 #include "util.h"
 #include "config.h"
+#include "scrollback.h"
 
 /*
  * All the basic styles and flags a single character cell can have. The
@@ -82,8 +83,8 @@ struct vt_cell {
 };
 
 struct vt_line {
-	struct vt_line *next, *prev;
 	uint16_t len;
+	uint16_t blank_from; /* Cells from this column onwards are blank */
 	struct vt_cell cells[0];
 };
 
@@ -112,9 +113,11 @@ struct vt {
 #define VT_FL_AUTOSCROLL (1 << 1)
 	uint32_t flags;
 
-	struct vt_line *topmost; /* Earliest line in the scroll buffer */
-	struct vt_line *bottommost; /* Latest line in the scroll buffer */
-	struct vt_line **lines; /* rows x cols view of writeable scroll buffer */
+	struct scrollback scrollback; /* Every line of the primary screen, earliest first */
+	size_t view; /* Scroll buffer index of the top line of the primary screen */
+	struct vt_line **lines; /* rows x cols view of the active screen */
+	struct vt_line **primary; /* rows x cols view of writeable scroll buffer */
+	struct vt_line **alternate; /* rows x cols screen which never scrolls back */
 
 	/* Places to hold interm escape code parameters */
 	struct {
@@ -125,6 +128,8 @@ struct vt {
 
 int vt_init(struct vt *vt, int rows, int cols);
 void vt_free(struct vt *vt);
+size_t vt_line_bytes(struct vt *vt);
+size_t vt_evict_scrollback(struct buffer *buffer, size_t lines);
 void vt_interpret(struct buffer *buffer, char c);
 struct vt_cell *vt_get_cell(struct buffer *buf, unsigned int row, unsigned int col);
 
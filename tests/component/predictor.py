@@ -0,0 +1,291 @@
+#!/usr/bin/env python2.7
+
+import tachyon
+import lousy
+import os
+import re
+import tempfile
+import time
+
+SHELL = '/bin/bash --noprofile --norc'
+
+# Key classes in the order the profile file stores them
+ALNUM, PUNCT, SPACE, TAB, ENTER, ERASE, CONTROL, ESCAPE, HIGH = range(9)
+
+class PredictorTestCase(tachyon.TachyonTestCase):
+	def setUp1(self):
+		fd, self.profile = tempfile.mkstemp(prefix='tachyon-profile-')
+		os.close(fd)
+
+	def tearDown1(self):
+		self.waitForTermination()
+		os.remove(self.profile)
+
+	# Start tachyon predicting with its own profile file. With a delay the
+	# shell is run behind tools/delayed_echo so predictions are shown.
+	def startPredicting(self, delay_ms=0):
+		shell = SHELL
+		if delay_ms:
+			shell = 'tools/delayed_echo -d %d -- %s' % (delay_ms, SHELL)
+		self.startTachyon(['--predict', '--profile=%s' % self.profile,
+			'--shell="%s"' % shell])
+
+	# Write a profile file holding one program's (keys, echoed) per class
+	def writeProfile(self, name, classes):
+		counts = ' '.join('%d %d' % c for c in classes)
+		with open(self.profile, 'w') as f:
+			f.write('tachyon-profile 3\n')
+			f.write('%s\t%s\n' % (name, counts))
+
+	# Return the (keys, echoed) per class saved for the program, or None
+	def readProfile(self, name):
+		with open(self.profile) as f:
+			self.assertEqual(f.readline(), 'tachyon-profile 3\n')
+			for line in f:
+				program, counts = line.rstrip('\n').split('\t')
+				if program == name:
+					counts = [int(c) for c in counts.split(' ')]
+					return zip(counts[0::2], counts[1::2])
+		return None
+
+	# Throw away whatever is typed on the line and exit the shell
+	def exitShell(self):
+		self.send(tachyon.control('e') + tachyon.control('u'))
+		self.sendLine('exit')
+
+	# Return how many keys have been predicted, from the stats overlay
+	def keysPredicted(self):
+		self.sendMeta('s')
+		self.syncOutput()
+
+		predicted = None
+		for row in range(self.vtyRows()):
+			line = self.tachyon.vty.string(row, 0, self.vtyCols())
+			match = re.search(r'keys predicted\s+(\d+) of', line)
+			if match:
+				predicted = int(match.group(1))
+				break
+
+		# Any key dismisses the overlay without reaching the shell
+		self.send(' ')
+
+		self.assertIsNotNone(predicted)
+		return predicted
+
+	# Predicted erasures are drawn as spaces
+	def assertVtyBlank(self, row, col):
+		self.syncOutput()
+		cell = self.tachyon.vty.cell(row, col)
+		self.assertIn(cell.char, ['', ' '])
+
+class TestPredictorSlowLink(PredictorTestCase):
+	DELAY_MS = 250
+
+	def setUp1(self):
+		PredictorTestCase.setUp1(self)
+		self.startPredicting(self.DELAY_MS)
+
+		# Predictions are only shown once a slow round trip is measured
+		self.sendCmd('echo warmup')
+
+	# Wait until the slave has answered everything typed
+	def waitEcho(self):
+		time.sleep(4 * self.DELAY_MS / 1000.0)
+
+	# Show a fresh prompt and return where input starts
+	def prompt(self):
+		self.sendLine('')
+		self.expectPrompt('bash.*\$ ')
+		self.waitEcho()
+		return self.vtyCursorPosition()
+
+	def test_predictionShownBeforeEcho(self):
+		row, col = self.prompt()
+
+		self.send('abc')
+
+		self.assertVtyString(row, col, 'abc')
+		self.assertVtyCursorPos(row, col + 3)
+
+		self.waitEcho()
+
+		self.assertVtyString(row, col, 'abc')
+		self.assertVtyCursorPos(row, col + 3)
+
+		self.exitShell()
+
+	def test_mispredictionErased(self):
+		self.sendCmd('read -s secret')
+		self.waitEcho()
+		row, col = self.vtyCursorPosition()
+
+		self.send('hi')
+
+		self.assertVtyString(row, col, 'hi')
+
+		# Nothing is echoed so the predictions time out
+		time.sleep(2)
+
+		self.assertVtyBlank(row, col)
+		self.assertVtyBlank(row, col + 1)
+
+		self.sendLine('')
+		self.exitShell()
+
+	def test_tentativePredictionUnderlined(self):
+		row, col = self.prompt()
+
+		# Enter started a new epoch, nothing in it is confirmed yet
+		self.send('a')
+
+		self.assertVtyCharIs(row, col, 'a')
+		self.assertVtyCharAttrIs(row, col, [lousy.FrameBufferCell.UNDERSCORE])
+
+		self.waitEcho()
+
+		self.assertVtyCharAttrIs(row, col, [])
+
+		# The echo confirmed the epoch, so later predictions in it aren't
+		self.send('b')
+
+		self.assertVtyCharIs(row, col + 1, 'b')
+		self.assertVtyCharAttrIs(row, col + 1, [])
+
+		self.exitShell()
+
+	def test_erasePredicted(self):
+		row, col = self.prompt()
+		self.send('abcd')
+		self.waitEcho()
+
+		self.send('\x7f')
+
+		self.assertVtyString(row, col, 'abc')
+		self.assertVtyBlank(row, col + 3)
+		self.assertVtyCursorPos(row, col + 3)
+
+		self.waitEcho()
+
+		self.assertVtyString(row, col, 'abc')
+		self.assertVtyBlank(row, col + 3)
+		self.assertVtyCursorPos(row, col + 3)
+
+		self.exitShell()
+
+	def test_insertPredicted(self):
+		row, col = self.prompt()
+		self.send('ac')
+		self.waitEcho()
+
+		# Move left and insert, the rest of the line moves right
+		self.send('\033[D')
+		self.send('b')
+
+		self.assertVtyString(row, col, 'abc')
+		self.assertVtyCursorPos(row, col + 2)
+
+		self.waitEcho()
+
+		self.assertVtyString(row, col, 'abc')
+		self.assertVtyCursorPos(row, col + 2)
+
+		self.exitShell()
+
+class TestPredictorFastLink(PredictorTestCase):
+	def setUp1(self):
+		PredictorTestCase.setUp1(self)
+		self.startPredicting()
+
+	def test_predictionHiddenOnFastLink(self):
+		# Raw mode without echo still predicts, but nothing is echoed
+		self.sendCmd('stty raw -echo; head -c 3 > /dev/null; stty sane')
+		time.sleep(0.5)
+		row, col = self.vtyCursorPosition()
+		before = self.keysPredicted()
+
+		self.send('hi')
+
+		self.assertVtyBlank(row, col)
+		self.assertVtyBlank(row, col + 1)
+
+		# Predictions are kept to measure the round trip, just not shown
+		self.assertGreater(self.keysPredicted(), before)
+
+		self.send('x')
+		self.exitShell()
+
+	def test_noPredictionWithoutEcho(self):
+		self.sendCmd('read -s secret')
+		time.sleep(0.5)
+		before = self.keysPredicted()
+
+		self.send('hunter2')
+
+		self.assertEqual(self.keysPredicted(), before)
+
+		# Prediction resumes once the line discipline echoes again
+		self.sendLine('')
+		self.expectPrompt('bash.*\$ ')
+		self.send('abc')
+
+		self.assertEqual(self.keysPredicted(), before + 3)
+
+		self.exitShell()
+
+class TestPredictorProfile(PredictorTestCase):
+	def test_profileSaved(self):
+		self.startPredicting()
+
+		self.sendCmd('echo hi')
+		self.exitShell()
+		self.waitForTermination()
+
+		classes = self.readProfile('bash')
+		self.assertIsNotNone(classes)
+		self.assertGreater(classes[ALNUM][0], 0)
+		self.assertGreater(classes[ALNUM][1], 0)
+
+	def test_profileLoaded(self):
+		self.writeProfile('bash', [(50, 50)] * 9)
+		self.startPredicting()
+
+		self.sendCmd('echo hi')
+		self.exitShell()
+		self.waitForTermination()
+
+		# What was learnt is added to what was loaded
+		classes = self.readProfile('bash')
+		self.assertGreater(classes[ALNUM][0], 50)
+		self.assertEqual(classes[TAB], (50, 50))
+
+	def test_invalidProfileIgnored(self):
+		# More echoed than typed can't be right, so nothing of it is used
+		classes = [(100, 0)] * 9
+		classes[PUNCT] = (10, 20)
+		self.writeProfile('bash', classes)
+		self.startPredicting()
+
+		before = self.keysPredicted()
+		self.send('abc')
+
+		self.assertEqual(self.keysPredicted(), before + 3)
+
+		self.exitShell()
+
+	def test_classesPredictedSeparately(self):
+		# Punctuation has always been echoed, letters never
+		classes = [(100, 100)] * 9
+		classes[ALNUM] = (100, 0)
+		self.writeProfile('bash', classes)
+		self.startPredicting()
+
+		before = self.keysPredicted()
+		self.send('..')
+
+		self.assertEqual(self.keysPredicted(), before + 2)
+
+		self.send('ab')
+
+		self.assertEqual(self.keysPredicted(), before + 2)
+
+		self.exitShell()
@@ -203,6 +203,38 @@ class TestTerminalEscapeCodes(tachyon.TachyonTestCase):
 		self.pipe.write('z')
 		self.assertVtyCharIs(0, 0, 'z')
 
+	def test_csiCursorPosition_rowOnly(self):
+		self.sendCsi('6f')
+
+		self.assertVtyCursorPos(5, 0)
+
+	def test_csiCursorPosition_colOnly(self):
+		self.sendCsi(';6f')
+
+		self.assertVtyCursorPos(0, 5)
+
+	def test_csiCursorPosition_pastMargin(self):
+		self.sendCsi('300;300f')
+
+		self.assertVtyCursorPos(self.vtyMaxRow(), self.vtyMaxCol())
+
+		self.pipe.write('z')
+		self.assertVtyCharIs(self.vtyMaxRow(), self.vtyMaxCol(), 'z')
+
+	def test_csiCursorPosition_negative(self):
+		self.pipe.write('hello')
+
+		self.sendCsi('-3;-3f')
+
+		self.assertVtyCursorPos(0, 0)
+
+		# Clearing at the clamped position must stay on the screen
+		self.sendCsi('2K')
+		self.pipe.write('x')
+
+		self.assertVtyCharIs(0, 0, 'x')
+		self.assertVtyCursorPos(0, 1)
+
 	def test_csiCursorUp_default(self):
 		self.pipe.write('adsfasdfadsf\r\nhjklhkjl')
 
@@ -586,6 +618,51 @@ class TestTerminalEscapeCodes(tachyon.TachyonTestCase):
 		for i in range(self.vtyMaxCol()):
 			self.assertVtyCharIs(10, i, '')
 
+	def test_csiClearLine_thenWritePastCursor(self):
+		self.setCursorPos(10, 0)
+		self.pipe.write('a' * self.vtyMaxCol())
+		self.setCursorPos(10, 20)
+
+		self.sendCsi('K')
+
+		# Cells skipped over after the erase must still read back blank
+		self.setCursorPos(10, 60)
+		self.pipe.write('b')
+
+		for i in range(20, 60):
+			self.assertVtyCharIs(10, i, '')
+		self.assertVtyCharIs(10, 60, 'b')
+		self.assertVtyString(10, 0, 'a' * 20)
+
+	def test_csiClearLine_twice(self):
+		self.setCursorPos(10, 0)
+		self.pipe.write('a' * self.vtyMaxCol())
+		self.setCursorPos(10, 40)
+		self.sendCsi('K')
+
+		self.setCursorPos(10, 0)
+		self.pipe.write('b' * 10)
+		self.setCursorPos(10, 5)
+		self.sendCsi('K')
+
+		self.assertVtyString(10, 0, 'b' * 5)
+		for i in range(5, self.vtyMaxCol()):
+			self.assertVtyCharIs(10, i, '')
+
+	def test_csiClearScreen_thenRedraw(self):
+		for i in range(self.vtyRows()):
+			self.setCursorPos(i, 0)
+			self.pipe.write('Row %d' % i)
+
+		self.sendCsi('2J')
+		self.setCursorPos(3, 10)
+		self.pipe.write('x')
+
+		for i in range(self.vtyRows()):
+			self.assertVtyCharIs(i, 0, '')
+		self.assertVtyCharIs(3, 9, '')
+		self.assertVtyCharIs(3, 10, 'x')
+
 	def test_escapeCursorDown(self):
 		self.setCursorPos(0, 0)
 		self.pipe.write('adsfasdfadsf\r\nhjklhkjl')
@@ -747,6 +824,28 @@ class TestTerminalEscapeCodes(tachyon.TachyonTestCase):
 		self.assertVtyCharIs(1, 8, 'z')
 		self.assertVtyCharIs(11, 0, 'a')
 
+	def test_escapeCursorUp_scrollBackAcrossChunks(self):
+		# Enough lines to span several chunks of the scroll buffer
+		lines = 600
+		for i in range(lines):
+			self.pipe.write('Row %d\r\n' % i)
+
+		top = lines - self.vtyMaxRow()
+		self.assertVtyString(0, 0, 'Row %d' % top)
+
+		self.setCursorPos(0, 0)
+		self.pipe.write('\033M' * top)
+
+		self.assertVtyString(0, 0, 'Row 0')
+		self.assertVtyString(self.vtyMaxRow(), 0, 'Row %d' % self.vtyMaxRow())
+
+		# And back down again, the lines below the screen come back in order
+		self.setCursorPos(self.vtyMaxRow(), 0)
+		self.pipe.write('\033D' * top)
+
+		self.assertVtyString(0, 0, 'Row %d' % top)
+		self.assertVtyString(self.vtyMaxRow() - 1, 0, 'Row %d' % (lines - 1))
+
 	def test_escapeResetState(self):
 		self.setCursorPos(10, 10);
 		self.pipe.write('a')
@@ -974,6 +1073,44 @@ class TestTerminalEscapeCodes(tachyon.TachyonTestCase):
 		self.sendCsi('1;2h')
 		self.sendCsi('1;2;3;h')
 
+	def test_alternateScreen(self):
+		self.setCursorPos(0, 0)
+		self.pipe.write('primary')
+		self.setCursorPos(5, 5)
+
+		self.sendCsi('?1049h')
+		self.pipe.write('alternate')
+
+		self.bufferNext()
+		self.bufferNext()
+
+		self.assertVtyString(5, 5, 'alternate')
+		self.assertVtyCharIs(0, 0, '')
+
+		self.sendCsi('?1049l')
+
+		self.bufferNext()
+		self.bufferNext()
+
+		self.assertVtyString(0, 0, 'primary')
+		self.assertVtyCharIs(5, 5, '')
+		self.assertVtyCursorPos(5, 5)
+
+	def test_alternateScreen_noScrollBack(self):
+		for i in range(self.vtyRows()):
+			self.pipe.write('Row %d\r\n' % i)
+
+		self.sendCsi('?1049h')
+		for i in range(self.vtyRows() + 5):
+			self.pipe.write('Alternate %d\r\n' % i)
+		self.sendCsi('?1049l')
+
+		# Scroll back past the top, only primary lines should appear
+		self.setCursorPos(0, 0)
+		self.sendEsc('M')
+
+		self.assertVtyString(0, 0, 'Row 0')
+
 	def test_setXtermWindowTitle(self):
 		title = 'asdf'
 		vty = self.getVtty()
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/util.h"
+#include "../src/buffer.h"
+#include "../src/predictor.h"
+#include "../bench/bench.h"
+
+static int send_input(struct buffer *buffer, int size, char *buf)
+{
+	return 0;
+}
+
+static void type(struct buffer *buffer, const char *keys)
+{
+	for (; *keys; keys++)
+		predictor_output(&buffer->predictor, buffer, 1, (char *)keys, send_input);
+}
+
+/*
+ * Paste "a a a ..." at the end of a long line on a wide terminal until the
+ * overlay is full. Each key after a space is inserted past the predicted
+ * end of the line and must still be counted against the room left.
+ */
+int t1(void)
+{
+	struct buffer *buffer;
+	char line[61];
+	int i;
+
+	buffer = buffer_init_detached(0, 24, 200);
+	if (!buffer)
+		return 1;
+
+	/* Inserting before existing text predicts a cell for every shifted one */
+	memset(line, 'x', 60);
+	line[60] = '\r';
+	predictor_learn(&buffer->predictor, buffer, sizeof(line), line);
+
+	vclock_set(1);
+	type(buffer, "a\x05" "b");
+	for (i = 0; i < 40; i++)
+		type(buffer, "a ");
+
+	if (buffer->predictor.overlay_used > ARRAY_SIZE(buffer->predictor.overlay))
+		return 1;
+
+	/* The statistics follow the overlay and are trampled by an overflow */
+	return buffer->predictor.stats.keys != 83;
+}
+
+int main(int argn, char **args)
+{
+	int result = 0;
+
+	result += t1();
+	printf("t1 %d\n", result);
+
+	return result;
+}
@@ -15,98 +15,442 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 /*
- * A simple program which takes every character from stdin and echos it to stdout
- * after a delay.
+ * A link emulator which delays bytes the way a slow network connection
+ * would. Each direction has a one way delay, random jitter and optionally
+ * a bandwidth cap with a burst allowance. Bytes are never reordered.
+ *
+ * Without a command every character from stdin is echoed to stdout after
+ * the delay. With a command after -- the command is run on a new pty and
+ * the link sits between it and our stdin and stdout, for example:
+ *
+ * delayed_echo -d 100 -j 20 -- ./tachyon
  */
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
-#include <fcntl.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
-#include <sys/select.h>
-#include <sys/time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#define DEFAULT_DELAY_MS 2000
+#define DEFAULT_BURST 1500
 
-#define DELAY_US (2000 * 1000)
-#define BUF_SIZE 4096
+/* Chunks in flight in each direction and the bytes they hold */
+#define QUEUE_CHUNKS 4096
+#define QUEUE_BYTES (1024 * 1024)
 
 #define STDIN 0
 #define STDOUT 1
 
-int main(int argn, char **args)
-{
-	int result;
-	struct timeval wait;
-	struct timeval now;
-	struct timeval *departure;
-	fd_set fds;
-	int used = 0;
+static struct {
+	uint64_t delay_us;
+	uint64_t jitter_us;
+	uint64_t bandwidth; /* Bytes per second, 0 for unlimited */
+	uint64_t burst;
+} config = {
+	.delay_us = DEFAULT_DELAY_MS * 1000,
+	.jitter_us = 0,
+	.bandwidth = 0,
+	.burst = DEFAULT_BURST,
+};
+
+/*
+ * A chunk of bytes which arrived together and leaves at departure. Since
+ * bytes are never reordered departures only increase, so each direction's
+ * queue is a FIFO ring rather than a general timer queue.
+ */
+struct chunk {
+	uint64_t departure;
+	int len;
+};
+
+struct link {
+	int in_fd;
+	int out_fd;
+	bool eof;
+
+	int chunks_head;
+	int chunks_used;
+	struct chunk chunks[QUEUE_CHUNKS];
+
+	int bytes_head;
+	int bytes_used;
+	char bytes[QUEUE_BYTES];
+
+	uint64_t last_departure;
+
+	/* Token bucket limiting the bandwidth, in bytes */
+	double tokens;
+	uint64_t refilled;
+};
+
+static struct link up;
+static struct link down;
+
+static struct termios original_termstate;
+static bool termstate_saved;
+
+static int min_int(int a, int b) {
+	return a < b ? a : b;
+}
+
+static uint64_t min_u64(uint64_t a, uint64_t b) {
+	return a < b ? a : b;
+}
+
+static uint64_t max_u64(uint64_t a, uint64_t b) {
+	return a > b ? a : b;
+}
+
+static uint64_t now_us(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000 * 1000 + now.tv_nsec / 1000;
+}
+
+static void link_init(struct link *link, int in_fd, int out_fd) {
+	memset(link, 0, sizeof(*link));
+	link->in_fd = in_fd;
+	link->out_fd = out_fd;
+	link->tokens = config.burst;
+	link->refilled = now_us();
+}
+
+static bool link_has_room(struct link *link) {
+	return link->chunks_used < QUEUE_CHUNKS && link->bytes_used < QUEUE_BYTES;
+}
+
+/*
+ * Read whatever is waiting on the input of the link and queue it to depart
+ * after the delay.
+ */
+static void link_receive(struct link *link, uint64_t now) {
+	char buf[4096];
+	struct chunk *chunk;
+	int64_t jitter = 0;
+	uint64_t departure;
+	int tail;
+	int len;
+
+	len = min_int(sizeof(buf), QUEUE_BYTES - link->bytes_used);
+	len = read(link->in_fd, buf, len);
+	if (len <= 0) {
+		if (len == 0 || errno != EINTR)
+			link->eof = true;
+		return;
+	}
+
+	tail = (link->bytes_head + link->bytes_used) % QUEUE_BYTES;
+	for (int i = 0; i < len; i++)
+		link->bytes[(tail + i) % QUEUE_BYTES] = buf[i];
+	link->bytes_used += len;
+
+	if (config.jitter_us)
+		jitter = (int64_t)(random() % (2 * config.jitter_us + 1)) - (int64_t)config.jitter_us;
+
+	departure = now + config.delay_us;
+	if (jitter < 0 && -jitter > departure - now)
+		departure = now;
+	else
+		departure += jitter;
+
+	if (departure < link->last_departure)
+		departure = link->last_departure;
+	link->last_departure = departure;
+
+	chunk = &link->chunks[(link->chunks_head + link->chunks_used) % QUEUE_CHUNKS];
+	chunk->departure = departure;
+	chunk->len = len;
+	link->chunks_used++;
+}
+
+static void link_refill(struct link *link, uint64_t now) {
+	if (!config.bandwidth)
+		return;
+
+	link->tokens += (now - link->refilled) * (double)config.bandwidth / 1e6;
+	if (link->tokens > config.burst)
+		link->tokens = config.burst;
+	link->refilled = now;
+}
+
+/*
+ * Write out every chunk whose departure has passed, as far as the
+ * bandwidth allows.
+ */
+static void link_send(struct link *link, uint64_t now) {
+	struct chunk *chunk;
+	int len;
+
+	link_refill(link, now);
+
+	while (link->chunks_used > 0) {
+		chunk = &link->chunks[link->chunks_head];
+		if (chunk->departure > now)
+			break;
+
+		len = chunk->len;
+		if (config.bandwidth && len > link->tokens)
+			len = link->tokens;
+		if (len == 0)
+			break;
+
+		/* Don't write past the end of the ring in one go */
+		len = min_int(len, QUEUE_BYTES - link->bytes_head);
+		len = write(link->out_fd, link->bytes + link->bytes_head, len);
+		if (len <= 0) {
+			/* The other end has gone away so nothing more can be sent */
+			if (len < 0 && errno != EINTR && errno != EAGAIN) {
+				link->chunks_used = 0;
+				link->bytes_used = 0;
+				link->eof = true;
+			}
+			break;
+		}
+
+		link->bytes_head = (link->bytes_head + len) % QUEUE_BYTES;
+		link->bytes_used -= len;
+		link->tokens -= len;
+
+		chunk->len -= len;
+		if (chunk->len == 0) {
+			link->chunks_head = (link->chunks_head + 1) % QUEUE_CHUNKS;
+			link->chunks_used--;
+		}
+	}
+}
+
+/*
+ * Returns when the link next has something to do, UINT64_MAX if never.
+ */
+static uint64_t link_next_event(struct link *link) {
+	uint64_t departure;
+
+	if (link->chunks_used == 0)
+		return UINT64_MAX;
+
+	departure = link->chunks[link->chunks_head].departure;
+
+	/* Waiting for the bucket to refill enough for a byte */
+	if (config.bandwidth && link->tokens < 1)
+		departure = max_u64(departure,
+				    link->refilled + (1 - link->tokens) * 1e6 / config.bandwidth + 1);
+
+	return departure;
+}
+
+static void restore_termstate(void) {
+	if (termstate_saved)
+		tcsetattr(STDIN, TCSANOW, &original_termstate);
+}
+
+/*
+ * Put our controlling terminal into the mode needed. With a child all the
+ * line discipline processing belongs to its pty, so ours is made raw.
+ */
+static void configure_termstate(bool raw) {
 	struct termios termstate;
 
-	struct {
-		char c;
-		struct timeval departure;
-	} buf[BUF_SIZE];
+	if (tcgetattr(STDIN, &termstate))
+		return;
 
-	tcgetattr(STDIN, &termstate);
-	termstate.c_lflag &= ~(ICANON | ECHO | ECHONL);
-	termstate.c_cc[VMIN] = 1;
+	original_termstate = termstate;
+	termstate_saved = true;
+	atexit(restore_termstate);
+
+	if (raw) {
+		cfmakeraw(&termstate);
+	} else {
+		termstate.c_lflag &= ~(ICANON | ECHO | ECHONL);
+		termstate.c_cc[VMIN] = 1;
+	}
 	tcsetattr(STDIN, TCSANOW, &termstate);
+}
+
+/*
+ * Run the command on a new pty the same size as our terminal.
+ *
+ * Returns the pty master on success and -1 on failure.
+ */
+static int spawn(char **args, pid_t *pid) {
+	struct winsize size;
+	int master;
+	int slave;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0)
+		return -1;
+
+	if (grantpt(master) || unlockpt(master))
+		goto err_master;
+
+	slave = open(ptsname(master), O_RDWR);
+	if (slave < 0)
+		goto err_master;
+
+	if (ioctl(STDIN, TIOCGWINSZ, &size) == 0)
+		ioctl(slave, TIOCSWINSZ, &size);
+
+	*pid = fork();
+	if (*pid < 0) {
+		close(slave);
+		goto err_master;
+	}
 
+	if (*pid == 0) {
+		/* Child */
+		close(master);
+
+		setsid();
+		dup2(slave, STDIN);
+		dup2(slave, STDOUT);
+		dup2(slave, 2);
+		if (slave > 2)
+			close(slave);
+		ioctl(STDIN, TIOCSCTTY, 1);
+
+		execvp(args[0], args);
+		fprintf(stderr, "Unable to exec %s: %s\n", args[0], strerror(errno));
+		_exit(127);
+	}
+
+	close(slave);
+	return master;
+
+err_master:
+	close(master);
+	return -1;
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [options] [-- command [args...]]\n", name);
+	printf("\t-d ms\tone way delay in each direction (default %d)\n", DEFAULT_DELAY_MS);
+	printf("\t-j ms\trandom jitter added to the delay, +/-\n");
+	printf("\t-b kbit\tbandwidth cap in each direction in kbit/s (default unlimited)\n");
+	printf("\t-B bytes\tburst allowed above the bandwidth cap (default %d)\n", DEFAULT_BURST);
+	printf("\t-h\tthis help\n");
+}
+
+int main(int argn, char **args)
+{
+	struct link *links[2] = {&down, &up};
+	int num_links;
+	struct pollfd fds[2];
+	int num_fds;
+	struct link *polled[2];
+	uint64_t now;
+	uint64_t next;
+	int timeout;
+	pid_t pid = -1;
+	int status = 0;
+	int master;
+	int opt;
+
+	while ((opt = getopt(argn, args, "+d:j:b:B:h")) != -1) {
+		switch (opt) {
+			case 'd':
+				config.delay_us = strtoull(optarg, NULL, 10) * 1000;
+				break;
+			case 'j':
+				config.jitter_us = strtoull(optarg, NULL, 10) * 1000;
+				break;
+			case 'b':
+				config.bandwidth = strtoull(optarg, NULL, 10) * 1000 / 8;
+				break;
+			case 'B':
+				config.burst = strtoull(optarg, NULL, 10);
+				if (config.burst < 1)
+					config.burst = 1;
+				break;
+			case 'h':
+				usage(args[0]);
+				return 0;
+			default:
+				usage(args[0]);
+				return 1;
+		}
+	}
+
+	srandom(getpid() ^ now_us());
 	setvbuf(stdout, NULL, _IONBF, 0);
 
-	used = 1;
-	result = fcntl(STDIN, F_SETFL, &used);
-	used = 0;
+	if (optind < argn) {
+		signal(SIGPIPE, SIG_IGN);
+
+		master = spawn(&args[optind], &pid);
+		if (master < 0) {
+			fprintf(stderr, "Unable to create pty: %s\n", strerror(errno));
+			return 1;
+		}
+
+		configure_termstate(true);
+		link_init(&down, master, STDOUT);
+		link_init(&up, STDIN, master);
+		num_links = 2;
+	} else {
+		configure_termstate(false);
+		link_init(&down, STDIN, STDOUT);
+		num_links = 1;
+	}
 
 	for (;;) {
-		if (used == 0) {
-			wait.tv_sec = 10000000;
-			wait.tv_usec = 0;
-		} else {
-			gettimeofday(&now, NULL);
-			departure = &buf[0].departure;
-			
-			wait.tv_sec = departure->tv_sec - now.tv_sec;
-			wait.tv_usec = departure->tv_usec - now.tv_usec;
-
-			if (wait.tv_usec < 0) {
-				wait.tv_sec -= 1;
-				wait.tv_usec += 1000000;
+		now = now_us();
+		next = UINT64_MAX;
+		num_fds = 0;
+
+		for (int i = 0; i < num_links; i++) {
+			link_send(links[i], now);
+			next = min_u64(next, link_next_event(links[i]));
+
+			if (!links[i]->eof && link_has_room(links[i])) {
+				fds[num_fds].fd = links[i]->in_fd;
+				fds[num_fds].events = POLLIN;
+				polled[num_fds] = links[i];
+				num_fds++;
 			}
 		}
 
-		if (wait.tv_sec != 0 || wait.tv_usec != 0) {
-			FD_ZERO(&fds);
-			FD_SET(STDIN, &fds);
-			result = select(STDIN + 1, &fds, NULL, NULL, &wait);
-		} else {
-			/* Print out the next character now */
-			result = 0;
-		}
+		/* Everything the child wrote has been delivered */
+		if (down.eof && down.chunks_used == 0)
+			break;
+
+		if (next == UINT64_MAX)
+			timeout = -1;
+		else if (next <= now)
+			timeout = 0;
+		else
+			timeout = (next - now + 999) / 1000;
 
-		if (result == 0) {
-			/* select timed out, output this character */
-			putc(buf[0].c, stdout);
-			used--;
-			memmove(buf, buf + 1, sizeof(buf[0]) * used);
-		} else {
-			/* Have a new character */
-			if (used == BUF_SIZE)
-				continue; /* Drop it */
-
-			result = read(STDIN, &(buf[used].c), 1);
-			if (result != 1)
+		if (poll(fds, num_fds, timeout) < 0) {
+			if (errno == EINTR)
 				continue;
-			departure = &buf[used].departure;
-			gettimeofday(departure, NULL);
-			departure->tv_usec += DELAY_US;
-			while (departure->tv_usec >   1000000) {
-				departure->tv_usec -= 1000000;
-				departure->tv_sec += 1;
-			}
-			used++;
+			return 1;
 		}
+
+		now = now_us();
+		for (int i = 0; i < num_fds; i++)
+			if (fds[i].revents)
+				link_receive(polled[i], now);
+	}
+
+	if (pid > 0) {
+		waitpid(pid, &status, 0);
+		if (WIFEXITED(status))
+			return WEXITSTATUS(status);
+		return 1;
 	}
 
 	return 0;
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2014  Travis Brown (travisb@travisbrown.ca)
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/*
+ * Convert a trace dumped by tachyon into the Chrome trace event JSON format,
+ * which can be loaded into chrome://tracing or Perfetto:
+ *
+ * trace2json trace > trace.json
+ *
+ * All events are on a single thread since tachyon has only the one.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../src/trace.h"
+
+static const struct {
+	const char *name;
+	char phase;
+} events[] = {
+#define TRACE_DESCRIBE(id, name, phase) [id] = {name, phase},
+	TRACE_EVENTS(TRACE_DESCRIBE)
+#undef TRACE_DESCRIBE
+};
+
+int main(int argn, char **args)
+{
+	char magic[sizeof(TRACE_MAGIC) - 1];
+	struct trace_event event;
+	uint32_t count;
+	const char *separator = "";
+	FILE *file;
+
+	if (argn != 2) {
+		fprintf(stderr, "Usage: %s trace\n", args[0]);
+		return 1;
+	}
+
+	file = fopen(args[1], "rb");
+	if (!file) {
+		perror(args[1]);
+		return 1;
+	}
+
+	if (fread(magic, sizeof(magic), 1, file) != 1 ||
+	    memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+	    fread(&count, sizeof(count), 1, file) != 1) {
+		fprintf(stderr, "%s isn't a tachyon trace\n", args[1]);
+		return 1;
+	}
+
+	printf("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (fread(&event, sizeof(event), 1, file) != 1) {
+			fprintf(stderr, "%s is truncated after %u events\n", args[1], i);
+			break;
+		}
+
+		if (event.id >= TRACE_MAX)
+			continue;
+
+		printf("%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %llu, \"pid\": 1, \"tid\": 1",
+		       separator, events[event.id].name, events[event.id].phase,
+		       (unsigned long long)event.time);
+		if (events[event.id].phase == 'i')
+			printf(", \"s\": \"t\"");
+		printf(", \"args\": {\"arg\": %u", event.arg);
+		if (event.bufid != TRACE_NO_BUFFER)
+			printf(", \"buffer\": %u", event.bufid);
+		printf("}}");
+
+		separator = ",\n";
+	}
+
+	printf("\n]}\n");
+	fclose(file);
+
+	return 0;
+}